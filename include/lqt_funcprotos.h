@@ -310,6 +310,35 @@ void quicktime_write_clap(quicktime_t *file, quicktime_clap_t *clap);
 
 
 
+/* cmodel_fast.c */
+
+/* Converts the output rows start..end-1 without scaling */
+typedef void (*cmodel_fast_func)(unsigned char **output_rows,
+                                 unsigned char **input_rows,
+                                 int in_y, int w, int h, int start, int end,
+                                 int in_rowspan, int out_rowspan,
+                                 int in_rowspan_uv, int out_rowspan_uv);
+
+cmodel_fast_func cmodel_fast_get(int in_colormodel, int out_colormodel);
+
+/* colormodels.c */
+
+LQT_EXTERN lqt_cmodel_plan_t *
+lqt_cmodel_plan_update(lqt_cmodel_plan_t *plan,
+                       int in_x, int in_y,
+                       int in_w, int in_h,
+                       int out_w, int out_h,
+                       int in_colormodel, int out_colormodel,
+                       int in_rowspan, int out_rowspan,
+                       int in_rowspan_uv, int out_rowspan_uv);
+
+LQT_EXTERN void lqt_cmodel_plan_transfer(lqt_cmodel_plan_t *plan,
+                                         unsigned char **output_rows,
+                                         unsigned char **input_rows,
+                                         quicktime_thread_pool_t *pool);
+
+void lqt_cmodel_plan_destroy(lqt_cmodel_plan_t *plan);
+
 /* cmodel_default.c */
 
 void cmodel_yuv420p(PERMUTATION_ARGS);
@@ -345,6 +374,9 @@ void quicktime_write_ctts(quicktime_t *file, quicktime_ctts_t *ctts);
 void quicktime_update_ctts(quicktime_ctts_t *ctts, long sample, long duration);
 void quicktime_compress_ctts(quicktime_ctts_t *ctts);
 void quicktime_fix_ctts(quicktime_ctts_t *ctts);
+void quicktime_ctts_build_index(quicktime_ctts_t *ctts);
+int64_t quicktime_sample_to_ctts(quicktime_ctts_t *ctts, int64_t sample,
+                                 int64_t * ctts_index, int64_t * ctts_count);
 
 /* dinf.c */
 
@@ -911,6 +943,8 @@ void quicktime_read_stsc(quicktime_t *file, quicktime_stsc_t *stsc);
 void quicktime_write_stsc(quicktime_t *file, quicktime_stsc_t *stsc);
 int quicktime_update_stsc(quicktime_stsc_t *stsc, long chunk, long samples);
 void quicktime_compress_stsc(quicktime_stsc_t *stsc);
+void quicktime_stsc_build_index(quicktime_stsc_t *stsc);
+long quicktime_stsc_find_chunk(quicktime_stsc_t *stsc, long chunk);
 
 /* stsd.c */
 
@@ -1014,6 +1048,9 @@ void quicktime_stss_delete(quicktime_stss_t *stss);
 void quicktime_stss_dump(quicktime_stss_t *stss);
 void quicktime_read_stss(quicktime_t *file, quicktime_stss_t *stss);
 void quicktime_write_stss(quicktime_t *file, quicktime_stss_t *stss);
+void quicktime_stss_build_index(quicktime_stss_t *stss, long total_samples);
+long quicktime_stss_find(quicktime_stss_t *stss, long sample);
+int quicktime_stss_is_sync(quicktime_stss_t *stss, long sample);
 
 /* stsz.c */
 
@@ -1032,6 +1069,7 @@ void quicktime_update_stsz(quicktime_stsz_t *stsz,
                            long sample, 
                            long sample_size);
 void quicktime_stsz_init_timecode(quicktime_stsz_t *stsz);
+void quicktime_stsz_build_index(quicktime_stsz_t *stsz);
 
 /* stts.c */
 
@@ -1061,6 +1099,10 @@ int64_t quicktime_time_to_sample(quicktime_stts_t *stts, int64_t * time,
 int64_t quicktime_sample_to_time(quicktime_stts_t *stts, int64_t sample,
                                  int64_t * stts_index, int64_t * stts_count);
 
+void quicktime_stts_build_index(quicktime_stts_t *stts);
+int64_t quicktime_stts_find(const int64_t * index, long total_entries,
+                            int64_t value, int inclusive);
+
 
 
 /* texttrack.c */
@@ -1321,10 +1363,17 @@ LQT_EXTERN void quicktime_wave_set_user_atom(quicktime_trak_t * trak, char * nam
 /* Disk I/O */
 int64_t quicktime_get_file_length(const char *path);
 int quicktime_file_open(quicktime_t *file, const char *path, int rd, int wr);
+int quicktime_file_open_io(quicktime_t *file, const lqt_io_callbacks_t * io,
+                           void * priv, int rd, int wr);
+int quicktime_file_open_memory(quicktime_t *file, const uint8_t * data, int64_t len);
+int quicktime_file_open_write_memory(quicktime_t *file, uint8_t ** data, int64_t * len);
+int64_t quicktime_write_block(quicktime_t *file, int64_t offset,
+                              const uint8_t *data, int64_t size);
 int quicktime_file_close(quicktime_t *file);
 int64_t quicktime_ftell(quicktime_t *file);
 int quicktime_fseek(quicktime_t *file, int64_t offset);
 LQT_EXTERN int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size);
+const uint8_t * quicktime_peek_data(quicktime_t *file, int64_t size);
 LQT_EXTERN int quicktime_write_data(quicktime_t *file, const uint8_t *data, int size);
 int64_t quicktime_byte_position(quicktime_t *file);
 void quicktime_read_pascal(quicktime_t *file, char *data);
@@ -1450,6 +1499,58 @@ LQT_EXTERN void lqt_finish_audio_vbr_frame(quicktime_t * file, int track, int nu
  */
 
 int64_t * lqt_get_chunk_sizes(quicktime_t * file, quicktime_trak_t *trak);
+int quicktime_build_chunk_map(quicktime_t * file);
+
+/* lqt_readahead.c */
+
+void quicktime_readahead_stop(quicktime_t * file);
+void quicktime_readahead_video(quicktime_t * file, int track, int64_t frame);
+void quicktime_readahead_audio(quicktime_t * file, int track, int64_t chunk);
+
+/* lqt_interleave.c */
+
+void quicktime_interleave_delete(quicktime_t * file);
+int64_t quicktime_interleave_start(quicktime_t * file, quicktime_trak_t * trak);
+int quicktime_interleave_write(quicktime_t * file, const uint8_t * data, int size);
+int64_t quicktime_interleave_position(quicktime_t * file);
+void quicktime_interleave_add_chunk(quicktime_t * file, long samples);
+void quicktime_interleave_flush(quicktime_t * file);
+
+/* lqt_cpu.c */
+
+int quicktime_cpu_flags(void);
+
+/* lqt_threads.c */
+
+quicktime_thread_pool_t * quicktime_thread_pool_create(quicktime_t * file,
+                                                       int num_threads);
+void quicktime_thread_pool_destroy(quicktime_thread_pool_t * p);
+int quicktime_thread_pool_threads(quicktime_thread_pool_t * p);
+void quicktime_thread_pool_run(quicktime_thread_pool_t * p,
+                               void (*func)(void * data, int job, int num_jobs),
+                               void * data, int num_jobs);
+
+/* lqt_fragment.c */
+
+void quicktime_fragment_init(quicktime_t * file);
+void quicktime_fragment_delete(quicktime_t * file);
+void quicktime_fragment_check(quicktime_t * file, quicktime_trak_t * trak);
+int64_t quicktime_fragment_start_chunk(quicktime_t * file);
+int quicktime_fragment_write(quicktime_t * file, const uint8_t * data, int size);
+int64_t quicktime_fragment_position(quicktime_t * file);
+void quicktime_fragment_add_chunk(quicktime_t * file, quicktime_trak_t * trak,
+                                  int64_t offset, int64_t size, long samples);
+void quicktime_fragment_write_mvex(quicktime_t * file);
+int quicktime_fragment_close(quicktime_t * file);
+void quicktime_fragment_read_mvex(quicktime_t * file, quicktime_atom_t * parent_atom);
+int quicktime_fragment_read(quicktime_t * file, quicktime_atom_t * atom);
+void quicktime_fragment_finish_read(quicktime_t * file);
+
+/* lqt_writer.c */
+
+int quicktime_writer_submit(quicktime_t * file);
+void quicktime_writer_sync(quicktime_t * file);
+void quicktime_writer_stop(quicktime_t * file);
 
 /* lqt_codecs.c */
 
@@ -131,6 +131,14 @@ const lqt_compression_info_t * lqt_get_video_compression_info(quicktime_t * file
 int lqt_read_audio_packet(quicktime_t * file, lqt_packet_t * p, int track);
 int lqt_read_video_packet(quicktime_t * file, lqt_packet_t * p, int track);
 
+/* Read the packet with the lowest file offset from all audio and video
+   tracks. Reading all packets this way reads the file sequentially.
+   Tracks which can't be read are skipped. Returns 0 if all tracks
+   are finished */
+
+int lqt_read_next_packet(quicktime_t * file, lqt_track_type_t * type,
+                         int * track, lqt_packet_t * p);
+
 /* Writing */
 
 int lqt_writes_compressed(lqt_file_type_t type,
@@ -64,7 +64,7 @@ void lqt_set_log_callback(lqt_log_callback_t cb, void * data);
  *
  * Use this of you want to call some low-level functions of the file.
  * Note, that this routine should be used with care, since it's easy
- * to screw things up.
+ * to screw things up. Returns -1 for files opened with custom I/O.
  */
   
 int lqt_fileno(quicktime_t *file);
@@ -785,7 +785,10 @@ int lqt_get_best_target_colormodel(int source, int const* target_options);
  *  overhead. i.e. you'll get the colormodel of your list, which is "closest" to the
  *  colormodel, the codec delivers. To make sure, that this function never fails, you
  *  should at least support \ref BC_RGB888 .
- *  This function works for en- and decoding.
+ *  This function works for en- and decoding. For decoding, colormodels
+ *  which the decoder can output directly (e.g. \ref BC_YUV420P for JPEG
+ *  streams in \ref BC_YUVJ420P) are preferred, because they need no
+ *  conversion after decoding.
  */
 
 int lqt_get_best_colormodel(quicktime_t * file, int track, int * supported);
@@ -1086,6 +1089,27 @@ int lqt_decode_video(quicktime_t *file,
 int lqt_read_video_frame(quicktime_t * file,
                          uint8_t ** buffer, int * buffer_alloc,
                          int64_t frame, int64_t * time, int track);
+
+/** \ingroup video_decode
+ *  \brief Get a compressed video frame without copying it
+ *  \param file A quicktime handle
+ *  \param track Track index (starting with 0)
+ *  \param frame Number of the frame (starting with 0)
+ *  \param data Returns a pointer to the frame data
+ *  \param len Returns the number of bytes in the frame
+ *  \returns 1 if the frame could be read, 0 else.
+ *
+ * If the file is memory mapped (see \ref lqt_open_read), data will point
+ * directly into the file. Otherwise the frame is read into a buffer,
+ * which is owned by the track. In both cases, the data must not be
+ * modified and are valid until the next call to this function for the
+ * same track or until the file is closed. Unlike \ref lqt_read_video_frame,
+ * the data are not zero padded, so use \ref lqt_read_video_frame if
+ * you need that (e.g. for passing the data to a decoder).
+ */
+
+int lqt_peek_video_frame(quicktime_t * file, int track, int64_t frame,
+                         const uint8_t ** data, int * len);
   
 /** \ingroup video_encode
  *  \brief Encode one video frame
@@ -1169,10 +1193,29 @@ int64_t lqt_video_duration(quicktime_t * file, int track);
  *  you should verify, that this colormodel can be used with
  *  \ref quicktime_reads_cmodel (for reading), \ref quicktime_writes_cmodel
  *  (for writing) or \ref lqt_get_best_colormodel (for reading and writing).
+ *
+ *  When decoding, some codecs can output other colormodels than the one
+ *  returned by \ref lqt_get_decoder_colormodel without an extra pass over
+ *  the frame. If the colormodel is one of them, the decoder switches to it.
  */
 
 void lqt_set_cmodel(quicktime_t *file, int track, int colormodel);
 
+/** \ingroup video
+ * \brief Set the number of threads for colorspace conversion
+ *  \param file A quicktime handle
+ *  \param track Track index (starting with 0)
+ *  \param threads Number of threads. 0 or 1 converts in the calling thread.
+ *
+ *  If the colormodel set with \ref lqt_set_cmodel is not the one of the
+ *  codec, \ref lqt_decode_video and \ref lqt_encode_video convert each
+ *  frame. With more than one thread, the frame is split into horizontal
+ *  slices, which are converted in parallel. The calling thread converts
+ *  one of the slices.
+ */
+
+void lqt_set_video_threads(quicktime_t * file, int track, int threads);
+
 /** \ingroup video_decode
  * \brief Get the number of video track edit segments
  *  \param file A quicktime handle
@@ -1623,17 +1666,146 @@ const char * lqt_file_type_to_string(lqt_file_type_t type);
 */
 
 lqt_file_type_t lqt_get_file_type(quicktime_t * file);
+
+/** \ingroup general
+ *  \brief Chunk in the file
+ */
+
+typedef struct
+  {
+  int64_t offset;          /*!< Absolute file position */
+  int64_t size;            /*!< Size in bytes */
+  lqt_track_type_t type;   /*!< Track type */
+  int track;               /*!< Audio, video or text track index (starting with 0) */
+  long chunk;              /*!< Chunk index inside the track (starting with 0) */
+  } lqt_chunk_info_t;
+
+/** \ingroup general
+    \brief Get the number of chunks of all tracks
+    \param file A quicktime handle
+    \returns The total number of chunks
+    
+    This function (together with \ref lqt_get_chunk_info) is meant for
+    demultiplexers, which want to read the file sequentially. It is only
+    valid for files opened for reading.
+*/
+
+long lqt_get_num_chunks(quicktime_t * file);
+
+/** \ingroup general
+    \brief Get a chunk in physical file order
+    \param file A quicktime handle
+    \param index Chunk index (starting with 0) as counted in file order
+    \param info Returns the chunk info
+    \returns 1 on success, 0 if index is out of range
+
+    Chunks are sorted by their file offset. The size is the distance
+    to the next chunk of any track (or to the end of the mdat atom),
+    so it may include padding. For AVI files, the size is taken from
+    the index.
+*/
+
+int lqt_get_chunk_info(quicktime_t * file, long index, lqt_chunk_info_t * info);
  
   
 /** \ingroup general
     \brief Open a file for reading
     \param filename A path to a regular file
     \returns An initialized file handle or NULL if opening failed.
-    
+
+    If the platform supports it, regular files are memory mapped and all
+    reads are served from the mapping. Pipes and files, which cannot be
+    mapped, are read with stdio.
 */
 
 quicktime_t * lqt_open_read(const char * filename);
 
+/** \ingroup general
+    \brief Read ahead in a background thread
+    \param file A quicktime handle (opened for reading)
+    \param frames Number of frames (or audio chunks) to read ahead. 0 stops the read ahead thread.
+
+    After a video frame or an audio chunk is read, the following frames
+    or chunks of the same track are read by a background thread,
+    so they are already in the operating system cache when the decoder
+    needs them. This is useful for playback from slow or network
+    storage.
+*/
+
+void lqt_set_readahead(quicktime_t * file, int frames);
+
+/** \ingroup general
+ *  \brief Callbacks for custom I/O
+ *
+ *  All callbacks get the private data pointer, which was passed to
+ *  \ref lqt_open_read_io or \ref lqt_open_write_io. Only the callbacks needed
+ *  for the respective mode must be set (read, seek and size for reading,
+ *  write and seek for writing). close is optional. It is called by
+ *  \ref quicktime_close and also if opening the file fails, so the private
+ *  data can always be freed there.
+ */
+
+typedef struct
+  {
+  /** Read len bytes. Return the number of bytes read (less than len at the end of the stream) or -1 on error */
+  int64_t (*read)(void * priv, uint8_t * data, int64_t len);
+  /** Write len bytes. Return the number of bytes written or -1 on error */
+  int64_t (*write)(void * priv, const uint8_t * data, int64_t len);
+  /** Seek to an absolute position. Return 0 on success */
+  int (*seek)(void * priv, int64_t pos);
+  /** Return the total size of the stream (needed for reading) or -1 on error, which makes opening fail */
+  int64_t (*size)(void * priv);
+  /** Free the private data */
+  void (*close)(void * priv);
+  } lqt_io_callbacks_t;
+
+/** \ingroup general
+    \brief Open a file for reading with custom I/O
+    \param io I/O callbacks (will be copied)
+    \param priv Private data passed to the callbacks
+    \returns An initialized file handle or NULL if opening failed.
+*/
+
+quicktime_t * lqt_open_read_io(const lqt_io_callbacks_t * io, void * priv);
+
+/** \ingroup general
+    \brief Open a file for writing with custom I/O
+    \param io I/O callbacks (will be copied)
+    \param priv Private data passed to the callbacks
+    \param type The type of the file, you want to create
+    \returns An initialized file handle or NULL if opening failed.
+*/
+
+quicktime_t * lqt_open_write_io(const lqt_io_callbacks_t * io, void * priv,
+                                lqt_file_type_t type);
+
+/** \ingroup general
+    \brief Open a file from memory
+    \param data Start of the file
+    \param len Length of the file in bytes
+    \returns An initialized file handle or NULL if opening failed.
+
+    The data are not copied, so they must stay valid until the file is
+    closed. Compressed frames can be accessed without copying with
+    \ref lqt_peek_video_frame.
+*/
+
+quicktime_t * lqt_open_read_memory(const uint8_t * data, int64_t len);
+
+/** \ingroup general
+    \brief Open a file for writing into memory
+    \param type The type of the file, you want to create
+    \param data Returns the file contents after \ref quicktime_close
+    \param len Returns the file size after \ref quicktime_close
+    \returns An initialized file handle or NULL if opening failed.
+
+    After \ref quicktime_close, *data contains the complete file. It must be
+    freed with free().
+*/
+
+quicktime_t * lqt_open_write_memory(lqt_file_type_t type,
+                                    uint8_t ** data, int64_t * len);
+
 /** \ingroup general
     \brief Open a file for reading
     \param filename A path to a regular file
@@ -1667,6 +1839,94 @@ quicktime_t * lqt_open_write(const char * filename, lqt_file_type_t type);
 
 quicktime_t * lqt_open_write_with_log(const char * filename, lqt_file_type_t type,
                                       lqt_log_callback_t cb, void * log_data);
+
+/** \ingroup general
+    \brief Write asynchronously
+    \param file A quicktime handle (opened for writing)
+    \param blocks Number of 1 MB write buffers. Values below 2 stop the writer thread.
+
+    Data are collected in a ring of buffers, which are written to disk by a
+    background thread. The encoding functions only block if all buffers are
+    waiting to be written. Write errors of the thread are reported by the
+    next write operation. \ref quicktime_close writes all pending buffers.
+*/
+
+void lqt_set_async_write(quicktime_t * file, int blocks);
+
+/** \ingroup general
+    \brief Preallocate disk space
+    \param file A quicktime handle (opened for writing)
+    \param bytes Expected file size
+
+    Reserve disk space for a file of the given size, so the filesystem
+    can allocate contiguous extents. If the file grows beyond the
+    allocated size, more space is reserved in large steps. Unused space
+    is released by \ref quicktime_close. This only works for regular
+    files and is silently ignored if the system doesn't support it.
+*/
+
+void lqt_set_expected_size(quicktime_t * file, int64_t bytes);
+
+/** \ingroup general
+    \brief Write the file header at the beginning
+    \param file A quicktime handle (opened for writing)
+    \param reserve Number of bytes to reserve for the header
+    \returns 0 on success, 1 if data were already written or the file is an AVI.
+
+    Reserve space for the movie header (moov atom) before the media data.
+    \ref quicktime_close then writes the header into this space, so the
+    file can be played while it's downloaded without calling
+    \ref quicktime_make_streamable. Unused space is marked as a free atom.
+    If the header doesn't fit, \ref quicktime_close moves the media data
+    to make room for it like \ref quicktime_make_streamable does. This is
+    only possible for files opened by name. For custom I/O or memory files,
+    the header is then written after the media data and
+    \ref quicktime_close returns 1. As a rule of thumb, the header needs
+    about 20 bytes per video frame and audio chunk.
+
+    Call this directly after \ref lqt_open_write.
+*/
+
+int lqt_set_faststart(quicktime_t * file, int64_t reserve);
+
+/** \ingroup general
+    \brief Interleave the tracks automatically
+    \param file A quicktime handle (opened for writing)
+    \param ms Duration of the interleave in milliseconds or 0
+    \returns 0 on success, 1 if the file is an AVI or a fragmented MP4 file.
+
+    Normally, each encoded audio buffer or video frame is written as a
+    separate chunk, so the layout of the file depends on the order in which
+    the tracks are encoded. With an interleave, the encoded data are
+    buffered in memory and written as one chunk per track, when all audio
+    and video tracks advanced by the given duration (e.g. 500 ms). This
+    results in smaller indices and fewer seeks during playback.
+    \ref quicktime_close writes the remaining data. Pass 0 to write the
+    buffered data and switch the interleaving off.
+*/
+
+int lqt_set_interleave(quicktime_t * file, int ms);
+
+/** \ingroup general
+    \brief Set the size of movie fragments
+    \param file A quicktime handle (opened with LQT_FILE_MP4_FRAGMENTED)
+    \param seconds Maximum duration of a fragment or 0
+    \param bytes Maximum size of a fragment or 0
+
+    Fragmented MP4 files are written as a sequence of movie fragments
+    (moof atoms, each followed by the media data in an mdat atom) after a
+    moov atom without samples. The sample tables are written and freed
+    after each fragment, so the memory usage doesn't grow with the
+    duration and files can be played while they are written or after a
+    crash. The media data of the current fragment are kept in memory until
+    the fragment is written. A fragment is finished when one of the limits
+    is reached. Fragments start at keyframes of the first video track
+    (or at any chunk of the first audio track for audio only files),
+    so the limits can be exceeded. The default is 2 seconds.
+    Timecode tracks are not supported in fragmented files.
+*/
+
+void lqt_set_fragment_limits(quicktime_t * file, double seconds, int64_t bytes);
   
 /** \ingroup general
     \brief Set the segment size for ODML AVIs
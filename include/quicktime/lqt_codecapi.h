@@ -198,6 +198,17 @@ int lqt_copy_audio(int16_t ** dst_i, float ** dst_f,
 int lqt_read_audio_chunk(quicktime_t * file, int track,
                          long chunk,
                          uint8_t ** buffer, int * buffer_alloc, int * samples);
+/*
+ *  Get one audio chunk without copying it. If the file is memory mapped,
+ *  data will point into the file, otherwise it points to a buffer owned
+ *  by the track. The data are valid until the next call for this track
+ *  and are NOT zero padded.
+ */
+
+int lqt_peek_audio_chunk(quicktime_t * file, int track,
+                         long chunk,
+                         const uint8_t ** data, int * len, int * samples);
+
 int lqt_append_audio_chunk(quicktime_t * file, int track,
                            long chunk,
                            uint8_t ** buffer, int * buffer_alloc,
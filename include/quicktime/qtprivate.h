@@ -65,12 +65,27 @@
 #define QTVR_GRABBER_UI 4
 #define QTVR_ABSOLUTE_UI 5
 
+/* CPU features (see lqt_cpu.c) */
+#define LQT_CPU_SSE2  (1<<0)
+#define LQT_CPU_SSSE3 (1<<1)
+#define LQT_CPU_AVX2  (1<<2)
+
 /* Forward declarations */
 
 typedef struct quicktime_strl_s quicktime_strl_t;
 
 typedef struct quicktime_codec_s quicktime_codec_t;
 
+typedef struct quicktime_readahead_s quicktime_readahead_t;
+
+typedef struct quicktime_writer_s quicktime_writer_t;
+
+typedef struct quicktime_fragment_s quicktime_fragment_t;
+typedef struct quicktime_interleave_s quicktime_interleave_t;
+
+typedef struct lqt_cmodel_plan_s lqt_cmodel_plan_t;
+typedef struct quicktime_thread_pool_s quicktime_thread_pool_t;
+
 typedef struct
   {
   /* for AVI it's the end of the 8 byte header in the file */
@@ -558,6 +573,19 @@ typedef struct
   long entries_allocated;
   int  default_duration;
   quicktime_stts_table_t *table;
+
+  /* Sample number of table[0] when writing. Nonzero if earlier
+     samples were already written into movie fragments */
+  long index_base;
+
+  /* Number of samples in the table when writing. Entries are run
+     length encoded as samples are added */
+  long num_samples;
+
+  /* Number of samples and time before each entry (total_entries + 1
+     values). Built after reading for fast seeking */
+  int64_t * index_samples;
+  int64_t * index_times;
   } quicktime_stts_t;
 
 /* Composition time to sample */
@@ -575,6 +603,15 @@ typedef struct
   long total_entries;
   long entries_allocated;
   quicktime_ctts_table_t *table;
+
+  /* Sample number of table[0] and number of samples in the table
+     when writing (see quicktime_stts_t) */
+  long index_base;
+  long num_samples;
+
+  /* Number of samples before each entry (total_entries + 1 values).
+     Built after reading for fast seeking */
+  int64_t * index_samples;
   } quicktime_ctts_t;
 
 /* sync sample */
@@ -590,6 +627,12 @@ typedef struct
   long total_entries;
   long entries_allocated;
   quicktime_stss_table_t *table;
+  /* Nonzero if the table is strictly ascending (binary search possible) */
+  int sorted;
+  /* Keyframe bitmap (one bit per sample up to the last sync sample),
+     built after reading */
+  uint8_t * bitmap;
+  long bitmap_samples;
   } quicktime_stss_t;
 
 
@@ -609,6 +652,10 @@ typedef struct
 	
   long entries_allocated;
   quicktime_stsc_table_t *table;
+
+  /* Number of the first sample (starting with 0) of each entry.
+     Built after reading for fast lookups */
+  int64_t * sample_index;
   } quicktime_stsc_t;
 
 
@@ -627,6 +674,14 @@ typedef struct
 
   long entries_allocated;    /* used by the library for allocating a table */
   quicktime_stsz_table_t *table;
+
+  /* Sample number of table[0] (see quicktime_stts_t) */
+  long index_base;
+
+  /* Cumulative sample sizes (total_entries + 1 entries). Built on demand
+     if size_index_enabled is set (i.e. when the table is complete) */
+  int size_index_enabled;
+  int64_t * size_index;
   } quicktime_stsz_t;
 
 
@@ -1353,10 +1408,29 @@ typedef struct
   /* PCM codecs need this */
   int block_align;
 
+  /* Used by lqt_peek_audio_chunk() if the file is not mapped */
+  uint8_t * peek_buffer;
+  int peek_buffer_alloc;
+
+  /* Next chunk to pass to the read ahead thread */
+  int64_t readahead_pos;
+
+  /* Set if lqt_read_next_packet() failed for this track,
+     cleared by quicktime_set_audio_position() */
+  int packets_failed;
+
   lqt_compression_info_t ci;
   
   } quicktime_audio_map_t;
 
+/* Entry of the timestamp hash (see lqt_video_append_timestamp()) */
+
+typedef struct
+  {
+  int64_t pts;
+  long pic_num;
+  } quicktime_pts_hash_t;
+
 typedef struct
   {
   quicktime_trak_t *track;
@@ -1377,6 +1451,12 @@ typedef struct
 
   int stream_cmodel; // Colormodel, which is read/written natively by the codec
   int io_cmodel;  // Colormodel, which is used by the encode/decode functions
+
+  /* Colormodels, which the decoder can output without an extra pass,
+     best first and terminated with LQT_COLORMODEL_NONE. Set by the
+     decoder, NULL if it supports only one. If io_cmodel is in the list, it becomes the
+     stream_cmodel and the decoder must output it from the next frame on */
+  const int * decoding_cmodels;
   int stream_row_span, stream_row_span_uv;
 
   int io_row_span, io_row_span_uv;
@@ -1385,6 +1465,12 @@ typedef struct
      (NOT recommended!!) */
   uint8_t ** temp_frame;
 
+  /* Cached parameters for converting from/to temp_frame */
+  lqt_cmodel_plan_t * cmodel_plan;
+
+  /* Threads for the conversion (see lqt_set_video_threads) */
+  quicktime_thread_pool_t * thread_pool;
+
   /* In some cases (IMX + VBI) the frame we are working with has greater
    * height than the track height from the tkhd atom.
    * This variable holds their difference. */
@@ -1413,9 +1499,19 @@ typedef struct
 
   int * picture_numbers;
   int picture_numbers_alloc;
+  /* Index of picture_numbers[0]. Nonzero for fragmented files, where
+     the beginning is dropped after each fragment */
+  long picture_numbers_start;
 
   int64_t * timestamps;
   int timestamps_alloc;
+  /* Index of timestamps[0] */
+  long timestamps_start;
+
+  /* Picture numbers of the most recent timestamps, hashed by
+     timestamp. Lets lqt_write_frame_header() find pictures without
+     searching the timestamps */
+  quicktime_pts_hash_t * pts_hash;
 
   int64_t duration;
 
@@ -1423,6 +1519,17 @@ typedef struct
   quicktime_atom_t chunk_atom;
   int keyframe;
 
+  /* Used by lqt_peek_video_frame() if the file is not mapped */
+  uint8_t * peek_buffer;
+  int peek_buffer_alloc;
+
+  /* Next frame to pass to the read ahead thread */
+  int64_t readahead_pos;
+
+  /* Set if lqt_read_next_packet() failed for this track,
+     cleared by quicktime_set_video_position() */
+  int packets_failed;
+
   lqt_compression_info_t ci;
   
   } quicktime_video_map_t;
@@ -1541,11 +1648,26 @@ typedef struct
   quicktime_pdat_t pdat;
   } quicktime_qtvr_node_t;
 
+/* One chunk in the global, file ordered chunk map */
+
+typedef struct
+  {
+  int64_t offset;
+  int64_t size;  /* Distance to the next chunk of any track */
+  int trak;      /* Index into moov.trak */
+  long chunk;    /* Chunk index inside the track (starting with 0) */
+  } quicktime_chunk_map_t;
+
 /* file descriptor passed to all routines */
 
 struct quicktime_s
   {
   FILE *stream;
+
+  /* Custom I/O (lqt_open_read_io(), lqt_open_write_io()).
+     If read or write is set, stream is NULL */
+  lqt_io_callbacks_t io;
+  void * io_priv;
   int64_t total_length;
   int encoding_started;
   quicktime_mdat_t mdat;
@@ -1568,6 +1690,14 @@ struct quicktime_s
   int64_t moov_end;
   int64_t moov_size;
 
+  /* Space for the moov atom at the start of the file
+     (lqt_set_faststart()) */
+  int64_t moov_reserve_start;
+  int64_t moov_reserve_size;
+  /* Path of files opened for writing, for moving the moov atom to
+     the start if it doesn't fit into the reserved space */
+  char * path;
+
   /* AVI tree */
   quicktime_riff_t *riff[MAX_RIFFS];
   int total_riffs;
@@ -1590,6 +1720,15 @@ struct quicktime_s
   int64_t preload_end;       /* End of preload buffer in file */
   int64_t preload_ptr;       /* Offset of preload_start in preload_buffer */
 
+  /* Read only mapping of the whole file. If this is non NULL,
+     quicktime_read_data() copies directly from the mapping and
+     the stdio stream is left alone. */
+  uint8_t *mmap_buffer;
+  int64_t mmap_size;
+
+  /* Background read ahead (lqt_set_readahead()) */
+  quicktime_readahead_t * readahead;
+
   /* Write ahead buffer */
   /* Amount of data in presave buffer */
   int64_t presave_size;
@@ -1598,6 +1737,28 @@ struct quicktime_s
   uint8_t *presave_buffer;
   /* Presave doesn't matter a whole lot, so its size is fixed */
 #define QUICKTIME_PRESAVE 0x100000
+  /* Larger writes bypass the presave buffer */
+#define QUICKTIME_DIRECT_WRITE (QUICKTIME_PRESAVE/4)
+
+  /* Asynchronous writer (lqt_set_async_write()) */
+  quicktime_writer_t * writer;
+
+  /* Movie fragments (LQT_FILE_MP4_FRAGMENTED) */
+  quicktime_fragment_t * fragment;
+
+  /* Chunk interleaving (lqt_set_interleave()) */
+  quicktime_interleave_t * interleave;
+
+  /* Preallocation (lqt_set_expected_size()) */
+  int64_t expected_size;
+  int64_t allocated_size;
+
+  /* Chunks of all tracks sorted by file offset, built on demand
+     when reading */
+  quicktime_chunk_map_t * chunk_map;
+  long chunk_map_size;
+  /* First chunk not completely read by lqt_read_next_packet() */
+  long chunk_map_pos;
 
   /* mapping of audio channels to movie tracks */
   /* one audio map entry exists for each channel */
@@ -159,8 +159,21 @@ typedef enum
     LQT_FILE_MP4      = (1<<4), /*!< .mp4 (ftyp = "mp42") */
     LQT_FILE_M4A      = (1<<5), /*!< .m4a  */
     LQT_FILE_3GP      = (1<<6), /*!< .3gp  */
+    LQT_FILE_MP4_FRAGMENTED = (1<<7), /*!< Fragmented .mp4 (only for \ref lqt_open_write, the file type will be LQT_FILE_MP4) */
   } lqt_file_type_t;
 
+/** \ingroup General
+ *  \brief Track types
+ */
+
+typedef enum
+  {
+    LQT_TRACK_NONE = 0, /*!< Unknown or unsupported track */
+    LQT_TRACK_AUDIO,    /*!< Audio track */
+    LQT_TRACK_VIDEO,    /*!< Video track */
+    LQT_TRACK_TEXT,     /*!< Text track */
+  } lqt_track_type_t;
+
   
 /** \ingroup multichannel
  *  \brief Channel definitions
@@ -602,13 +615,16 @@ quicktime_t* quicktime_open(const char *filename, int rd, int wr);
 /** \ingroup general
     \brief Make a file streamable 
     \param in_path Existing non streamable file
-    \param out_path Output file
+    \param out_path Output file or NULL
     \returns 1 if an error occurred, 0 else
 
     This function makes a file streamable by placing the moov header at the beginning of the file.
     Note that you need approximately the twice the disk-space of the file. It is recommended, that
     this function is called only for files, which are encoded by libquicktime. Other files might not
     be correctly written.
+
+    If out_path is NULL or the same file as in_path, the file is converted in place.
+    This needs no extra disk space, but the file will be corrupted if the conversion is interrupted.
 */
   
 int quicktime_make_streamable(char *in_path, char *out_path);
@@ -797,6 +813,7 @@ void quicktime_set_row_span(quicktime_t *file, int row_span);
 /** \ingroup general
  * \brief Close a quicktime handle and free all associated memory
  * \param file A quicktime handle
+ * \returns 0 on success, 1 if the file could not be finished properly
  */
   
 int quicktime_close(quicktime_t *file);
@@ -1098,6 +1115,7 @@ int quicktime_read_frame_end(quicktime_t *file, int track);
 
 /* One keyframe table for each track */
 long quicktime_get_keyframe_before(quicktime_t *file, long frame, int track);
+long quicktime_get_keyframe_after(quicktime_t *file, long frame, int track);
 void quicktime_insert_keyframe(quicktime_t *file, long frame, int track);
 /* Track has keyframes */
 int quicktime_has_keyframes(quicktime_t *file, int track);
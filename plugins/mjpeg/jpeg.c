@@ -31,6 +31,19 @@
 
 #define LOG_DOMAIN "mjpeg"
 
+/* Colormodels, which can be converted from the jpeg data while copying
+   the decoded frame */
+
+static const int decoding_cmodels_420[] =
+  { BC_YUVJ420P, BC_YUV420P, BC_RGB888, BC_RGBA8888, LQT_COLORMODEL_NONE };
+
+static const int decoding_cmodels_422[] =
+  { BC_YUVJ422P, BC_YUV422P, BC_YUV420P, BC_YUV422, BC_RGB888, BC_RGBA8888,
+    LQT_COLORMODEL_NONE };
+
+static const int decoding_cmodels_444[] =
+  { BC_YUVJ444P, BC_RGB888, BC_RGBA8888, LQT_COLORMODEL_NONE };
+
 // Jpeg types
 #define JPEG_PROGRESSIVE 0
 #define JPEG_MJPA 1
@@ -120,6 +133,18 @@ static int decode(quicktime_t *file,
       {
       /* Detect colormodel and return */
       vtrack->stream_cmodel = mjpeg->jpeg_color_model;
+      switch(mjpeg->jpeg_color_model)
+        {
+        case BC_YUVJ420P:
+          vtrack->decoding_cmodels = decoding_cmodels_420;
+          break;
+        case BC_YUVJ422P:
+          vtrack->decoding_cmodels = decoding_cmodels_422;
+          break;
+        case BC_YUVJ444P:
+          vtrack->decoding_cmodels = decoding_cmodels_444;
+          break;
+        }
       codec->have_frame = 1;
 
       /* Set compression info */
@@ -135,7 +160,7 @@ static int decode(quicktime_t *file,
   else
     mjpeg_set_rowspan(codec->mjpeg, 0, 0);
     
-  mjpeg_get_frame(codec->mjpeg, row_pointers);
+  mjpeg_get_frame(codec->mjpeg, row_pointers, vtrack->stream_cmodel, vtrack);
   codec->have_frame = 0;
   
   return result;
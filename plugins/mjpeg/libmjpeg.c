@@ -995,20 +995,46 @@ int mjpeg_decompress(mjpeg_t *mjpeg,
   return 0;
   }
 
-void mjpeg_get_frame(mjpeg_t * mjpeg, uint8_t ** row_pointers)
+void mjpeg_get_frame(mjpeg_t * mjpeg, uint8_t ** row_pointers, int colormodel,
+                     quicktime_video_map_t * vtrack)
   {
   uint8_t * cpy_rows[3];
+  int rowspan, rowspan_uv;
 
   // Copy to buffer first
 
   cpy_rows[0] = mjpeg->temp_rows[0][0];
   cpy_rows[1] = mjpeg->temp_rows[1][0];
   cpy_rows[2] = mjpeg->temp_rows[2][0];
+
+  if(colormodel == mjpeg->jpeg_color_model)
+    {
+    lqt_rows_copy(row_pointers,
+                  cpy_rows, mjpeg->output_w, mjpeg->output_h, mjpeg->coded_w, mjpeg->coded_w_uv,
+                  mjpeg->rowspan, mjpeg->rowspan_uv, mjpeg->jpeg_color_model);
+    return;
+    }
+
+  /* Convert while copying, so the caller needs no extra pass */
   
-  lqt_rows_copy(row_pointers,
-                cpy_rows, mjpeg->output_w, mjpeg->output_h, mjpeg->coded_w, mjpeg->coded_w_uv,
-                mjpeg->rowspan, mjpeg->rowspan_uv, mjpeg->jpeg_color_model);
+  if(mjpeg->rowspan)
+    {
+    rowspan = mjpeg->rowspan;
+    rowspan_uv = mjpeg->rowspan_uv;
+    }
+  else
+    lqt_get_default_rowspan(colormodel, mjpeg->output_w, &rowspan, &rowspan_uv);
   
+  /* Use the cached plan and the thread pool of the track */
+  vtrack->cmodel_plan =
+    lqt_cmodel_plan_update(vtrack->cmodel_plan,
+                           0, 0, mjpeg->output_w, mjpeg->output_h,
+                           mjpeg->output_w, mjpeg->output_h,
+                           mjpeg->jpeg_color_model, colormodel,
+                           mjpeg->coded_w, rowspan,
+                           mjpeg->coded_w_uv, rowspan_uv);
+  lqt_cmodel_plan_transfer(vtrack->cmodel_plan, row_pointers, cpy_rows,
+                           vtrack->thread_pool);
   }
 
 void mjpeg_set_quality(mjpeg_t *mjpeg, int quality)
@@ -138,7 +138,10 @@ extern "C" {
                        long buffer_len,
                        long input_field2);
 
-  void mjpeg_get_frame(mjpeg_t * mjpeg, uint8_t ** row_pointers);
+  /* Converts to colormodel if it's not the jpeg_color_model,
+     using the colormodel plan and thread pool of vtrack */
+  void mjpeg_get_frame(mjpeg_t * mjpeg, uint8_t ** row_pointers, int colormodel,
+                       quicktime_video_map_t * vtrack);
 
 
   int mjpeg_compress(mjpeg_t *mjpeg, 
@@ -163,12 +163,12 @@ static int flush_data(quicktime_t *file, int track)
             {
             /* Special case: We need to add a final sample to the stream */
           
-            if(vtrack->duration <= vtrack->timestamps[vtrack->current_position-1])
+            if(vtrack->duration <= vtrack->timestamps[vtrack->current_position-1-vtrack->timestamps_start])
               {
               quicktime_trak_t * trak = vtrack->track;
               quicktime_stts_t * stts = &trak->mdia.minf.stbl.stts;
               lqt_video_append_timestamp(file, track,
-                                         vtrack->timestamps[vtrack->current_position-1] +
+                                         vtrack->timestamps[vtrack->current_position-1-vtrack->timestamps_start] +
                                          stts->default_duration, 1);
               }
             else
@@ -69,6 +69,9 @@ static void initialize(quicktime_video_map_t *vtrack,
     codec->initialized = 1;
     }
 
+static const int decoding_cmodels[] =
+    { BC_YUV422P16, BC_YUV422P10, LQT_COLORMODEL_NONE };
+
 static int decode(quicktime_t *file, unsigned char **row_pointers, int track)
     {
     uint32_t i1, i2, i3, i4;
@@ -81,13 +84,20 @@ static int decode(quicktime_t *file, unsigned char **row_pointers, int track)
     quicktime_v210_codec_t *codec = vtrack->codec->priv;
     int width = vtrack->track->tkhd.track_width;
     int height = vtrack->track->tkhd.track_height;
+    int shift_lo, shift_mid, shift_hi;
 
     if  (!row_pointers)
         {
         vtrack->stream_cmodel = BC_YUV422P16;
+        vtrack->decoding_cmodels = decoding_cmodels;
         return 0;
         }
 
+/* The 10 bit samples are scaled to 16 bit unless we output BC_YUV422P10 */
+    shift_lo = (vtrack->stream_cmodel == BC_YUV422P10) ? 0 : 6;
+    shift_mid = 10 - shift_lo;
+    shift_hi = 20 - shift_lo;
+
     initialize(vtrack, codec, width, height);
 
     bytes = lqt_read_video_frame(file, &codec->buffer, &codec->buffer_alloc,
@@ -121,20 +131,20 @@ static int decode(quicktime_t *file, unsigned char **row_pointers, int track)
             i3 = iptr[8] | (iptr[9] << 8) | (iptr[10] << 16) | (iptr[11] << 24);
             i4 = iptr[12] | (iptr[13] << 8) | (iptr[14] << 16) | (iptr[15] << 24);
 /* These are grouped to show the "pixel pairs" of  4:2:2 */
-            *(out_u++) = (i1 & 0x3ff) << 6;       /* Cb0 */
-            *(out_y++) = (i1 & 0xffc00) >> 4;     /* Y0 */
-            *(out_v++) = (i1 & 0x3ff00000) >> 14; /* Cr0 */
-            *(out_y++) = (i2 & 0x3ff) << 6;       /* Y1 */
-
-            *(out_u++) = (i2 & 0xffc00) >> 4;     /* Cb1 */
-            *(out_y++) = (i2 & 0x3ff00000) >> 14; /* Y2 */
-            *(out_v++) = (i3 & 0x3ff) << 6;       /* Cr1 */
-            *(out_y++) = (i3 & 0xffc00) >> 4;     /* Y3 */
-
-            *(out_u++) = (i3 & 0x3ff00000) >> 14; /* Cb2 */
-            *(out_y++) = (i4 & 0x3ff) << 6;       /* Y4 */
-            *(out_v++) = (i4 & 0xffc00) >> 4;     /* Cr2 */
-            *(out_y++) = (i4 & 0x3ff00000) >> 14; /* Y5 */
+            *(out_u++) = (i1 & 0x3ff) << shift_lo;          /* Cb0 */
+            *(out_y++) = (i1 & 0xffc00) >> shift_mid;       /* Y0 */
+            *(out_v++) = (i1 & 0x3ff00000) >> shift_hi;     /* Cr0 */
+            *(out_y++) = (i2 & 0x3ff) << shift_lo;          /* Y1 */
+
+            *(out_u++) = (i2 & 0xffc00) >> shift_mid;       /* Cb1 */
+            *(out_y++) = (i2 & 0x3ff00000) >> shift_hi;     /* Y2 */
+            *(out_v++) = (i3 & 0x3ff) << shift_lo;          /* Cr1 */
+            *(out_y++) = (i3 & 0xffc00) >> shift_mid;       /* Y3 */
+
+            *(out_u++) = (i3 & 0x3ff00000) >> shift_hi;     /* Cb2 */
+            *(out_y++) = (i4 & 0x3ff) << shift_lo;          /* Y4 */
+            *(out_v++) = (i4 & 0xffc00) >> shift_mid;       /* Cr2 */
+            *(out_y++) = (i4 & 0x3ff00000) >> shift_hi;     /* Y5 */
             }
 /* Handle the 2 or 4 pixels possibly remaining */
          j = (width - ((width / 6) * 6));
@@ -144,16 +154,16 @@ static int decode(quicktime_t *file, unsigned char **row_pointers, int track)
             i2 = iptr[4] | (iptr[5] << 8) | (iptr[6] << 16) | (iptr[7] << 24);
             i3 = iptr[8] | (iptr[9] << 8) | (iptr[10] << 16) | (iptr[11] << 24);
             i4 = iptr[12] | (iptr[13] << 8) | (iptr[14] << 16) | (iptr[15] << 24);
-            *(out_u++) = (i1 & 0x3ff) << 6;       /* Cb0 */
-            *(out_y++) = (i1 & 0xffc00) >> 4;     /* Y0 */
-            *(out_v++) = (i1 & 0x3ff00000) >> 14; /* Cr0 */
-            *(out_y++) = (i2 & 0x3ff) << 6;       /* Y1 */
+            *(out_u++) = (i1 & 0x3ff) << shift_lo;          /* Cb0 */
+            *(out_y++) = (i1 & 0xffc00) >> shift_mid;       /* Y0 */
+            *(out_v++) = (i1 & 0x3ff00000) >> shift_hi;     /* Cr0 */
+            *(out_y++) = (i2 & 0x3ff) << shift_lo;          /* Y1 */
 	    if (j == 4)
 	       {
-               *(out_u++) = (i2 & 0xffc00) >> 4;     /* Cb1 */
-               *(out_y++) = (i2 & 0x3ff00000) >> 14; /* Y2 */
-               *(out_v++) = (i3 & 0x3ff) << 6;       /* Cr1 */
-               *(out_y++) = (i3 & 0xffc00) >> 4;     /* Y3 */
+               *(out_u++) = (i2 & 0xffc00) >> shift_mid;       /* Cb1 */
+               *(out_y++) = (i2 & 0x3ff00000) >> shift_hi;     /* Y2 */
+               *(out_v++) = (i3 & 0x3ff) << shift_lo;          /* Cr1 */
+               *(out_y++) = (i3 & 0xffc00) >> shift_mid;       /* Y3 */
 	       }
 	   }
 	}
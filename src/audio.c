@@ -24,6 +24,12 @@
 
 #include "lqt_private.h"
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <emmintrin.h>
+#define HAVE_SSE2
+#define TARGET(t) __attribute__((target(t)))
+#endif
+
 #define LOG_DOMAIN "audio"
 
 /***************************************************
@@ -224,6 +230,65 @@ static void encode_float_to_int16(float ** in, void * _out, int num_channels, in
     }
   }
 
+#ifdef HAVE_SSE2
+
+/* SSE2 versions of the conversions between int16 and float for mono
+   and stereo. The results are exactly the same as with the macros
+   above: The multiplication is done in double precision and out of range
+   values are saturated. */
+
+TARGET("sse2") static inline __m128i float_to_int16_sse2(const float * in)
+  {
+  const __m128d scale = _mm_set1_pd(32767.0);
+  __m128 f0 = _mm_loadu_ps(in);
+  __m128 f1 = _mm_loadu_ps(in + 4);
+  __m128i i0, i1;
+
+  i0 = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(f0), scale)),
+                          _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(f0, f0)), scale)));
+  i1 = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(f1), scale)),
+                          _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(f1, f1)), scale)));
+  return _mm_packs_epi32(i0, i1);
+  }
+
+TARGET("sse2") static int encode_float_to_int16_sse2(float ** in, void * _out,
+                                                     int num_channels, int num_samples)
+  {
+  int j = 0, tmp;
+  int16_t * out = _out;
+  __m128i l, r;
+
+  if(num_channels == 1)
+    {
+    for(; j + 8 <= num_samples; j += 8)
+      _mm_storeu_si128((__m128i*)(out + j), float_to_int16_sse2(in[0] + j));
+    for(; j < num_samples; j++)
+      {
+      FLOAT_TO_INT16(in[0][j], out[j]);
+      }
+    return 1;
+    }
+  else if(num_channels == 2)
+    {
+    for(; j + 8 <= num_samples; j += 8)
+      {
+      l = float_to_int16_sse2(in[0] + j);
+      r = float_to_int16_sse2(in[1] + j);
+      _mm_storeu_si128((__m128i*)(out + 2*j),     _mm_unpacklo_epi16(l, r));
+      _mm_storeu_si128((__m128i*)(out + 2*j + 8), _mm_unpackhi_epi16(l, r));
+      }
+    for(; j < num_samples; j++)
+      {
+      FLOAT_TO_INT16(in[0][j], out[2*j]);
+      FLOAT_TO_INT16(in[1][j], out[2*j+1]);
+      }
+    return 1;
+    }
+  return 0;
+  }
+
+#endif
+
 static void encode_float_to_int32(float ** in, void * _out, int num_channels, int num_samples)
   {
   int i, j;
@@ -292,7 +357,14 @@ void lqt_convert_audio_encode(quicktime_t * file, int16_t ** in_int, float ** in
       if(in_int)
         encode_int16_to_int16(in_int, out, num_channels, num_samples);
       else if(in_float)
+        {
+#ifdef HAVE_SSE2
+        if((quicktime_cpu_flags() & LQT_CPU_SSE2) &&
+           encode_float_to_int16_sse2(in_float, out, num_channels, num_samples))
+          break;
+#endif
         encode_float_to_int16(in_float, out, num_channels, num_samples);
+        }
       break;
     case LQT_SAMPLE_INT32:
       if(in_int)
@@ -482,6 +554,62 @@ static void decode_int16_to_float(void * _in, float ** out, int num_channels, in
     }
   }
 
+#ifdef HAVE_SSE2
+
+/* 4 int16 samples from the lower half of a register */
+
+TARGET("sse2") static inline __m128 int16_to_float_sse2(__m128i i)
+  {
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  return _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(i, i), 16)), scale);
+  }
+
+TARGET("sse2") static int decode_int16_to_float_sse2(void * _in, float ** out,
+                                                     int num_channels, int num_samples)
+  {
+  int j = 0;
+  int16_t * in = _in;
+  __m128i i;
+  __m128 f0, f1;
+
+  if(num_channels == 1)
+    {
+    if(!out[0])
+      return 1;
+    for(; j + 8 <= num_samples; j += 8)
+      {
+      i = _mm_loadu_si128((const __m128i*)(in + j));
+      _mm_storeu_ps(out[0] + j,     int16_to_float_sse2(i));
+      _mm_storeu_ps(out[0] + j + 4, int16_to_float_sse2(_mm_unpackhi_epi64(i, i)));
+      }
+    for(; j < num_samples; j++)
+      {
+      INT16_TO_FLOAT(in[j], out[0][j]);
+      }
+    return 1;
+    }
+  else if((num_channels == 2) && out[0] && out[1])
+    {
+    for(; j + 4 <= num_samples; j += 4)
+      {
+      i = _mm_loadu_si128((const __m128i*)(in + 2*j));
+      f0 = int16_to_float_sse2(i);
+      f1 = int16_to_float_sse2(_mm_unpackhi_epi64(i, i));
+      _mm_storeu_ps(out[0] + j, _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(out[1] + j, _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+      }
+    for(; j < num_samples; j++)
+      {
+      INT16_TO_FLOAT(in[2*j],   out[0][j]);
+      INT16_TO_FLOAT(in[2*j+1], out[1][j]);
+      }
+    return 1;
+    }
+  return 0;
+  }
+
+#endif
+
 static void decode_int32_to_float(void * _in, float ** out, int num_channels, int num_samples)
   {
   int i, j;
@@ -559,7 +687,14 @@ void lqt_convert_audio_decode(quicktime_t * file,
       if(out_int)
         decode_int16_to_int16(in, out_int, num_channels, num_samples);
       if(out_float)
+        {
+#ifdef HAVE_SSE2
+        if((quicktime_cpu_flags() & LQT_CPU_SSE2) &&
+           decode_int16_to_float_sse2(in, out_float, num_channels, num_samples))
+          break;
+#endif
         decode_int16_to_float(in, out_float, num_channels, num_samples);
+        }
       break;
     case LQT_SAMPLE_INT32:
       if(out_int)
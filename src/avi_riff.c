@@ -296,12 +296,7 @@ static void insert_audio_packet(quicktime_trak_t * trak,
   
   stsc = &trak->mdia.minf.stbl.stsc;
 
-  /* stsc will be initialized with 1 entry and zero samples */
-
-  if(stsc->table[0].samples == 0)
-    quicktime_update_stsc(stsc, 0, num_samples);
-  else
-    quicktime_update_stsc(stsc, stsc->total_entries, num_samples);
+  quicktime_update_stsc(stsc, stco->total_entries - 1, num_samples);
 
   /* Update total samples */
 
@@ -336,7 +331,10 @@ static void insert_video_packet(quicktime_trak_t * trak,
 
   if(!size)
     {
-    stts->table[stts->total_entries-1].sample_duration += stts->default_duration;
+    if(stsz->total_entries)
+      quicktime_update_stts(stts, stsz->total_entries - 1,
+                            stts->table[stts->total_entries-1].sample_duration +
+                            stts->default_duration);
     return;
     }
   
@@ -351,7 +349,7 @@ static void insert_video_packet(quicktime_trak_t * trak,
     stss = &trak->mdia.minf.stbl.stss;
     if(stss->entries_allocated <= stss->total_entries)
       {
-      stss->entries_allocated += 16;
+      stss->entries_allocated = stss->entries_allocated * 2 + 16;
       stss->table = realloc(stss->table, 
                             sizeof(quicktime_stss_table_t) * stss->entries_allocated);
       }
@@ -0,0 +1,844 @@
+/*******************************************************************************
+ cmodel_fast.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Row kernels for the most common unscaled conversions.
+ *
+ *  The output is exactly the same as from the generic code in cmodel_*.c:
+ *  The same tables are used (they are not linear, so they cannot be
+ *  replaced by multiplications), but the chroma terms are looked up once
+ *  per chroma sample instead of once per pixel, and the sums are shifted,
+ *  clipped and interleaved 8 pixels at a time with SSE2 or NEON. With
+ *  SSSE3, RGB888 is packed with byte shuffles, with AVX2 the table
+ *  lookups are done with gather instructions.
+ *
+ *  Packed YUV 4:2:2 is split into planes with byte shuffles.
+ */
+
+#define HAVE_RGB_TO_YUV
+#define HAVE_RGB_TO_YUVJ
+#define HAVE_YUV_TO_RGB
+#define HAVE_YUVJ_TO_RGB
+
+#include "lqt_private.h"
+#include "colorspace_tables.h"
+#include "colorspace_macros.h"
+#include <quicktime/colormodels.h>
+#include <string.h>
+#include <pthread.h>
+
+/* x86 code for all instruction sets is compiled and selected at runtime
+   (see lqt_cpu.c) */
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define SIMD_X86
+#define TARGET(t) __attribute__((target(t)))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+/* Pixels per SIMD block */
+#define BLOCK 8
+
+typedef struct
+{
+	const int * y;
+	const int * v_r;
+	const int * u_g;
+	const int * v_g;
+	const int * u_b;
+} yuv_to_rgb_t;
+
+typedef struct
+{
+	const int * r_y;
+	const int * g_y;
+	const int * b_y;
+	const int * r_u;
+	const int * g_u;
+	const int * b_u;
+	const int * r_v;
+	const int * g_v;
+	const int * b_v;
+} rgb_to_yuv_t;
+
+static const yuv_to_rgb_t yuv_to_rgb =
+{
+	y_to_rgb, v_to_r, u_to_g, v_to_g, u_to_b
+};
+
+static const yuv_to_rgb_t yuvj_to_rgb =
+{
+	yj_to_rgb, vj_to_r, uj_to_g, vj_to_g, uj_to_b
+};
+
+static const rgb_to_yuv_t rgb_to_yuv =
+{
+	r_to_y, g_to_y, b_to_y,
+	r_to_u, g_to_u, b_to_u,
+	r_to_v, g_to_v, b_to_v
+};
+
+static const rgb_to_yuv_t rgb_to_yuvj =
+{
+	r_to_yj, g_to_yj, b_to_yj,
+	r_to_uj, g_to_uj, b_to_uj,
+	r_to_vj, g_to_vj, b_to_vj
+};
+
+/* Plain C versions, they also convert the pixels left over by the SIMD
+   versions (starting with pixel j) */
+
+static void yuv_to_rgb_row_c(const yuv_to_rgb_t * t,
+	unsigned char *output,
+	const unsigned char *input_y,
+	const unsigned char *input_u,
+	const unsigned char *input_v,
+	int j,
+	int w,
+	int alpha)
+{
+	int i_tmp;
+	int pixelsize = alpha ? 4 : 3;
+
+	output += j * pixelsize;
+
+	for(; j < w; j++)
+	{
+		int y = t->y[input_y[j]];
+		int u = input_u[j / 2];
+		int v = input_v[j / 2];
+
+		i_tmp = (y + t->v_r[v]) >> 16;
+		output[0] = RECLIP_8(i_tmp);
+		i_tmp = (y + t->u_g[u] + t->v_g[v]) >> 16;
+		output[1] = RECLIP_8(i_tmp);
+		i_tmp = (y + t->u_b[u]) >> 16;
+		output[2] = RECLIP_8(i_tmp);
+		if(alpha)
+			output[3] = 0xff;
+		output += pixelsize;
+	}
+}
+
+static void rgb_to_y_row_c(const rgb_to_yuv_t * t,
+	unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	input += 3 * j;
+
+	for(; j < w; j++)
+	{
+		output_y[j] = (t->r_y[input[0]] + t->g_y[input[1]] + t->b_y[input[2]]) >> 16;
+		input += 3;
+	}
+}
+
+static void yuv422_split_row_c(unsigned char *output_y,
+	unsigned char *output_u,
+	unsigned char *output_v,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	for(; j < w; j++)
+	{
+		const unsigned char *px = input + ((j * 2) & ~3);
+		if(!(j & 1))
+		{
+			output_y[j] = px[0];
+			output_u[j / 2] = px[1];
+			output_v[j / 2] = px[3];
+		}
+		else
+			output_y[j] = px[2];
+	}
+}
+
+static void yuv422_y_row_c(unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	for(; j < w; j++)
+		output_y[j] = input[2 * j];
+}
+
+#if defined(SIMD_X86) || defined(SIMD_NEON)
+
+/* Table sums of 8 pixels (4 chroma samples) */
+
+static inline void yuv_to_rgb_lookup(const yuv_to_rgb_t * t,
+	const unsigned char *y,
+	const unsigned char *u,
+	const unsigned char *v,
+	int *r, int *g, int *b)
+{
+	int k, y_t, r_t = 0, g_t = 0, b_t = 0;
+
+	for(k = 0; k < BLOCK; k++)
+	{
+		if(!(k & 1))
+		{
+			r_t = t->v_r[v[k/2]];
+			g_t = t->u_g[u[k/2]] + t->v_g[v[k/2]];
+			b_t = t->u_b[u[k/2]];
+		}
+		y_t = t->y[y[k]];
+		r[k] = y_t + r_t;
+		g[k] = y_t + g_t;
+		b[k] = y_t + b_t;
+	}
+}
+
+static inline void rgb_to_y_lookup(const rgb_to_yuv_t * t,
+	const unsigned char *input,
+	int *y)
+{
+	int k;
+
+	for(k = 0; k < BLOCK; k++)
+	{
+		y[k] = t->r_y[input[0]] + t->g_y[input[1]] + t->b_y[input[2]];
+		input += 3;
+	}
+}
+
+#endif
+
+#ifdef SIMD_X86
+
+/* >> 16 and RECLIP_8() of 8 sums */
+
+TARGET("sse2") static inline __m128i shift_clip_sse2(__m128i s0, __m128i s1)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(s0, 16), _mm_srai_epi32(s1, 16));
+}
+
+/* Clip 8 pixels and interleave them to RGBA */
+
+TARGET("sse2") static inline void pack_rgba_sse2(__m128i r0, __m128i r1,
+	__m128i g0, __m128i g1,
+	__m128i b0, __m128i b1,
+	__m128i *lo, __m128i *hi)
+{
+	__m128i rg, ba;
+
+	rg = _mm_packus_epi16(shift_clip_sse2(r0, r1), shift_clip_sse2(g0, g1));
+	ba = _mm_packus_epi16(shift_clip_sse2(b0, b1), _mm_set1_epi16(0xff));
+
+/* r0 g0 r1 g1 ... and b0 ff b1 ff ... */
+	rg = _mm_unpacklo_epi8(rg, _mm_srli_si128(rg, 8));
+	ba = _mm_unpacklo_epi8(ba, _mm_srli_si128(ba, 8));
+
+	*lo = _mm_unpacklo_epi16(rg, ba);
+	*hi = _mm_unpackhi_epi16(rg, ba);
+}
+
+TARGET("sse2") static inline void store_rgb_sse2(unsigned char *output,
+	__m128i lo, __m128i hi)
+{
+	uint8_t rgba[BLOCK * 4];
+	int k;
+
+	_mm_storeu_si128((__m128i*)rgba, lo);
+	_mm_storeu_si128((__m128i*)(rgba + 16), hi);
+	for(k = 0; k < BLOCK; k++)
+	{
+		output[3*k]   = rgba[4*k];
+		output[3*k+1] = rgba[4*k+1];
+		output[3*k+2] = rgba[4*k+2];
+	}
+}
+
+/* Drop the alpha bytes with byte shuffles, writes exactly 24 bytes */
+
+TARGET("ssse3") static inline void store_rgb_ssse3(unsigned char *output,
+	__m128i lo, __m128i hi)
+{
+	const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+		-1, -1, -1, -1);
+
+	lo = _mm_shuffle_epi8(lo, mask);
+	hi = _mm_shuffle_epi8(hi, mask);
+	_mm_storeu_si128((__m128i*)output, _mm_or_si128(lo, _mm_slli_si128(hi, 12)));
+	_mm_storel_epi64((__m128i*)(output + 16), _mm_srli_si128(hi, 4));
+}
+
+#define LOAD_SUMS(s0, s1, sums) \
+	s0 = _mm_loadu_si128((const __m128i*)(sums)); \
+	s1 = _mm_loadu_si128((const __m128i*)((sums) + 4));
+
+TARGET("sse2") static void yuv_to_rgb_row_sse2(const yuv_to_rgb_t * t,
+	unsigned char *output,
+	const unsigned char *input_y,
+	const unsigned char *input_u,
+	const unsigned char *input_v,
+	int j,
+	int w,
+	int alpha)
+{
+	int r[BLOCK], g[BLOCK], b[BLOCK];
+	__m128i r0, r1, g0, g1, b0, b1, lo, hi;
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		yuv_to_rgb_lookup(t, input_y + j, input_u + j / 2, input_v + j / 2, r, g, b);
+		LOAD_SUMS(r0, r1, r);
+		LOAD_SUMS(g0, g1, g);
+		LOAD_SUMS(b0, b1, b);
+		pack_rgba_sse2(r0, r1, g0, g1, b0, b1, &lo, &hi);
+
+		if(alpha)
+		{
+			_mm_storeu_si128((__m128i*)(output + 4 * j), lo);
+			_mm_storeu_si128((__m128i*)(output + 4 * j + 16), hi);
+		}
+		else
+			store_rgb_sse2(output + 3 * j, lo, hi);
+	}
+	yuv_to_rgb_row_c(t, output, input_y, input_u, input_v, j, w, alpha);
+}
+
+TARGET("ssse3") static void yuv_to_rgb_row_ssse3(const yuv_to_rgb_t * t,
+	unsigned char *output,
+	const unsigned char *input_y,
+	const unsigned char *input_u,
+	const unsigned char *input_v,
+	int j,
+	int w,
+	int alpha)
+{
+	int r[BLOCK], g[BLOCK], b[BLOCK];
+	__m128i r0, r1, g0, g1, b0, b1, lo, hi;
+
+	if(alpha)
+	{
+		yuv_to_rgb_row_sse2(t, output, input_y, input_u, input_v, j, w, alpha);
+		return;
+	}
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		yuv_to_rgb_lookup(t, input_y + j, input_u + j / 2, input_v + j / 2, r, g, b);
+		LOAD_SUMS(r0, r1, r);
+		LOAD_SUMS(g0, g1, g);
+		LOAD_SUMS(b0, b1, b);
+		pack_rgba_sse2(r0, r1, g0, g1, b0, b1, &lo, &hi);
+		store_rgb_ssse3(output + 3 * j, lo, hi);
+	}
+	yuv_to_rgb_row_c(t, output, input_y, input_u, input_v, j, w, alpha);
+}
+
+/* 4 chroma samples, each one for 2 pixels */
+
+TARGET("avx2") static inline __m256i load_chroma_avx2(const unsigned char *c)
+{
+	uint32_t tmp;
+	__m128i c8;
+
+	memcpy(&tmp, c, 4);
+	c8 = _mm_cvtsi32_si128(tmp);
+	return _mm256_cvtepu8_epi32(_mm_unpacklo_epi8(c8, c8));
+}
+
+/* The table lookups are done with gather instructions */
+
+TARGET("avx2") static void yuv_to_rgb_row_avx2(const yuv_to_rgb_t * t,
+	unsigned char *output,
+	const unsigned char *input_y,
+	const unsigned char *input_u,
+	const unsigned char *input_v,
+	int j,
+	int w,
+	int alpha)
+{
+	__m256i y_i, u_i, v_i, y_t, r, g, b;
+	__m128i lo, hi;
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		y_i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(input_y + j)));
+		u_i = load_chroma_avx2(input_u + j / 2);
+		v_i = load_chroma_avx2(input_v + j / 2);
+
+		y_t = _mm256_i32gather_epi32(t->y, y_i, 4);
+		r = _mm256_add_epi32(y_t, _mm256_i32gather_epi32(t->v_r, v_i, 4));
+		g = _mm256_add_epi32(y_t,
+			_mm256_add_epi32(_mm256_i32gather_epi32(t->u_g, u_i, 4),
+				_mm256_i32gather_epi32(t->v_g, v_i, 4)));
+		b = _mm256_add_epi32(y_t, _mm256_i32gather_epi32(t->u_b, u_i, 4));
+
+		pack_rgba_sse2(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1),
+			_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1),
+			_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1),
+			&lo, &hi);
+
+		if(alpha)
+		{
+			_mm_storeu_si128((__m128i*)(output + 4 * j), lo);
+			_mm_storeu_si128((__m128i*)(output + 4 * j + 16), hi);
+		}
+		else
+			store_rgb_ssse3(output + 3 * j, lo, hi);
+	}
+	yuv_to_rgb_row_c(t, output, input_y, input_u, input_v, j, w, alpha);
+}
+
+TARGET("sse2") static void rgb_to_y_row_sse2(const rgb_to_yuv_t * t,
+	unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	int y[BLOCK];
+	__m128i y0, y1;
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		rgb_to_y_lookup(t, input + 3 * j, y);
+		LOAD_SUMS(y0, y1, y);
+		y0 = shift_clip_sse2(y0, y1);
+		_mm_storel_epi64((__m128i*)(output_y + j), _mm_packus_epi16(y0, y0));
+	}
+	rgb_to_y_row_c(t, output_y, input, j, w);
+}
+
+TARGET("sse2") static void yuv422_split_row_sse2(unsigned char *output_y,
+	unsigned char *output_u,
+	unsigned char *output_v,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i in0, in1, uv;
+
+	for(; j + 16 <= w; j += 16)
+	{
+		in0 = _mm_loadu_si128((const __m128i*)(input + 2 * j));
+		in1 = _mm_loadu_si128((const __m128i*)(input + 2 * j + 16));
+
+		_mm_storeu_si128((__m128i*)(output_y + j),
+			_mm_packus_epi16(_mm_and_si128(in0, mask), _mm_and_si128(in1, mask)));
+
+/* u0 v0 u1 v1 ... */
+		uv = _mm_packus_epi16(_mm_srli_epi16(in0, 8), _mm_srli_epi16(in1, 8));
+		_mm_storel_epi64((__m128i*)(output_u + j / 2),
+			_mm_packus_epi16(_mm_and_si128(uv, mask), mask));
+		_mm_storel_epi64((__m128i*)(output_v + j / 2),
+			_mm_packus_epi16(_mm_srli_epi16(uv, 8), mask));
+	}
+	yuv422_split_row_c(output_y, output_u, output_v, input, j, w);
+}
+
+TARGET("sse2") static void yuv422_y_row_sse2(unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+
+	for(; j + 16 <= w; j += 16)
+	{
+		_mm_storeu_si128((__m128i*)(output_y + j),
+			_mm_packus_epi16(
+				_mm_and_si128(_mm_loadu_si128((const __m128i*)(input + 2 * j)), mask),
+				_mm_and_si128(_mm_loadu_si128((const __m128i*)(input + 2 * j + 16)), mask)));
+	}
+	yuv422_y_row_c(output_y, input, j, w);
+}
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+
+/* >> 16 and RECLIP_8() of 8 sums */
+
+static inline uint8x8_t shift_clip_neon(const int *s)
+{
+	return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(vld1q_s32(s), 16)),
+		vqmovn_s32(vshrq_n_s32(vld1q_s32(s + 4), 16))));
+}
+
+static void yuv_to_rgb_row_neon(const yuv_to_rgb_t * t,
+	unsigned char *output,
+	const unsigned char *input_y,
+	const unsigned char *input_u,
+	const unsigned char *input_v,
+	int j,
+	int w,
+	int alpha)
+{
+	int r[BLOCK], g[BLOCK], b[BLOCK];
+	uint8x8x4_t px;
+	uint8x8x3_t px3;
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		yuv_to_rgb_lookup(t, input_y + j, input_u + j / 2, input_v + j / 2, r, g, b);
+
+		if(alpha)
+		{
+			px.val[0] = shift_clip_neon(r);
+			px.val[1] = shift_clip_neon(g);
+			px.val[2] = shift_clip_neon(b);
+			px.val[3] = vdup_n_u8(0xff);
+			vst4_u8(output + 4 * j, px);
+		}
+		else
+		{
+			px3.val[0] = shift_clip_neon(r);
+			px3.val[1] = shift_clip_neon(g);
+			px3.val[2] = shift_clip_neon(b);
+			vst3_u8(output + 3 * j, px3);
+		}
+	}
+	yuv_to_rgb_row_c(t, output, input_y, input_u, input_v, j, w, alpha);
+}
+
+static void rgb_to_y_row_neon(const rgb_to_yuv_t * t,
+	unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	int y[BLOCK];
+
+	for(; j + BLOCK <= w; j += BLOCK)
+	{
+		rgb_to_y_lookup(t, input + 3 * j, y);
+		vst1_u8(output_y + j, shift_clip_neon(y));
+	}
+	rgb_to_y_row_c(t, output_y, input, j, w);
+}
+
+static void yuv422_split_row_neon(unsigned char *output_y,
+	unsigned char *output_u,
+	unsigned char *output_v,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	uint8x8x4_t in;
+	uint8x8x2_t y;
+
+	for(; j + 16 <= w; j += 16)
+	{
+		in = vld4_u8(input + 2 * j);
+		y.val[0] = in.val[0];
+		y.val[1] = in.val[2];
+		vst2_u8(output_y + j, y);
+		vst1_u8(output_u + j / 2, in.val[1]);
+		vst1_u8(output_v + j / 2, in.val[3]);
+	}
+	yuv422_split_row_c(output_y, output_u, output_v, input, j, w);
+}
+
+static void yuv422_y_row_neon(unsigned char *output_y,
+	const unsigned char *input,
+	int j,
+	int w)
+{
+	for(; j + 16 <= w; j += 16)
+		vst1q_u8(output_y + j, vld2q_u8(input + 2 * j).val[0]);
+	yuv422_y_row_c(output_y, input, j, w);
+}
+
+#endif /* SIMD_NEON */
+
+/* Kernels for the CPU we are running on */
+
+typedef struct
+{
+	void (*yuv_to_rgb_row)(const yuv_to_rgb_t * t,
+		unsigned char *output,
+		const unsigned char *input_y,
+		const unsigned char *input_u,
+		const unsigned char *input_v,
+		int j, int w, int alpha);
+	void (*rgb_to_y_row)(const rgb_to_yuv_t * t,
+		unsigned char *output_y,
+		const unsigned char *input,
+		int j, int w);
+	void (*yuv422_split_row)(unsigned char *output_y,
+		unsigned char *output_u,
+		unsigned char *output_v,
+		const unsigned char *input,
+		int j, int w);
+	void (*yuv422_y_row)(unsigned char *output_y,
+		const unsigned char *input,
+		int j, int w);
+} kernels_t;
+
+static const kernels_t kernels_c =
+{
+	yuv_to_rgb_row_c, rgb_to_y_row_c, yuv422_split_row_c, yuv422_y_row_c
+};
+
+#ifdef SIMD_X86
+static const kernels_t kernels_sse2 =
+{
+	yuv_to_rgb_row_sse2, rgb_to_y_row_sse2, yuv422_split_row_sse2, yuv422_y_row_sse2
+};
+
+static const kernels_t kernels_ssse3 =
+{
+	yuv_to_rgb_row_ssse3, rgb_to_y_row_sse2, yuv422_split_row_sse2, yuv422_y_row_sse2
+};
+
+static const kernels_t kernels_avx2 =
+{
+	yuv_to_rgb_row_avx2, rgb_to_y_row_sse2, yuv422_split_row_sse2, yuv422_y_row_sse2
+};
+#endif
+
+#ifdef SIMD_NEON
+static const kernels_t kernels_neon =
+{
+	yuv_to_rgb_row_neon, rgb_to_y_row_neon, yuv422_split_row_neon, yuv422_y_row_neon
+};
+#endif
+
+static const kernels_t *kernels = &kernels_c;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static const kernels_t * get_kernels(int cpu_flags)
+{
+#ifdef SIMD_X86
+	if(cpu_flags & LQT_CPU_AVX2)
+		return &kernels_avx2;
+	if(cpu_flags & LQT_CPU_SSSE3)
+		return &kernels_ssse3;
+	if(cpu_flags & LQT_CPU_SSE2)
+		return &kernels_sse2;
+#endif
+#ifdef SIMD_NEON
+	return &kernels_neon;
+#endif
+	return &kernels_c;
+}
+
+static void init_kernels(void)
+{
+	kernels = get_kernels(quicktime_cpu_flags());
+}
+
+/* Frame functions */
+
+#define YUV_TO_RGB_FUNC(name, tables, uv_shift, alpha) \
+static void name(unsigned char **output_rows, \
+	unsigned char **input_rows, \
+	int in_y, \
+	int w, \
+	int h, \
+	int start, \
+	int end, \
+	int in_rowspan, \
+	int out_rowspan, \
+	int in_rowspan_uv, \
+	int out_rowspan_uv) \
+{ \
+	int i; \
+	for(i = start; i < end; i++) \
+	{ \
+		int row = i + in_y; \
+		kernels->yuv_to_rgb_row(&tables, output_rows[i], \
+			input_rows[0] + row * in_rowspan, \
+			input_rows[1] + (row >> uv_shift) * in_rowspan_uv, \
+			input_rows[2] + (row >> uv_shift) * in_rowspan_uv, \
+			0, w, alpha); \
+	} \
+}
+
+YUV_TO_RGB_FUNC(yuv420p_to_rgb888,    yuv_to_rgb,  1, 0)
+YUV_TO_RGB_FUNC(yuv420p_to_rgba8888,  yuv_to_rgb,  1, 1)
+YUV_TO_RGB_FUNC(yuvj420p_to_rgb888,   yuvj_to_rgb, 1, 0)
+YUV_TO_RGB_FUNC(yuvj420p_to_rgba8888, yuvj_to_rgb, 1, 1)
+YUV_TO_RGB_FUNC(yuv422p_to_rgb888,    yuv_to_rgb,  0, 0)
+YUV_TO_RGB_FUNC(yuv422p_to_rgba8888,  yuv_to_rgb,  0, 1)
+YUV_TO_RGB_FUNC(yuvj422p_to_rgb888,   yuvj_to_rgb, 0, 0)
+YUV_TO_RGB_FUNC(yuvj422p_to_rgba8888, yuvj_to_rgb, 0, 1)
+
+/*
+ *  The generic code calculates the chroma for every pixel and overwrites
+ *  it until the last pixel (usually the odd one) of each chroma sample.
+ *  We calculate only the chroma which survives.
+ */
+
+static void rgb_to_uv_row(const rgb_to_yuv_t * t,
+	unsigned char *output_u,
+	unsigned char *output_v,
+	const unsigned char *input,
+	int w)
+{
+	int j;
+	const unsigned char * px;
+
+	for(j = 0; j < (w + 1) / 2; j++)
+	{
+		px = input + 3 * ((2 * j + 1 < w) ? 2 * j + 1 : 2 * j);
+		output_u[j] = (t->r_u[px[0]] + t->g_u[px[1]] + t->b_u[px[2]]) >> 16;
+		output_v[j] = (t->r_v[px[0]] + t->g_v[px[1]] + t->b_v[px[2]]) >> 16;
+	}
+}
+
+#define RGB_TO_YUV_FUNC(name, tables, uv_shift) \
+static void name(unsigned char **output_rows, \
+	unsigned char **input_rows, \
+	int in_y, \
+	int w, \
+	int h, \
+	int start, \
+	int end, \
+	int in_rowspan, \
+	int out_rowspan, \
+	int in_rowspan_uv, \
+	int out_rowspan_uv) \
+{ \
+	int i; \
+	for(i = start; i < end; i++) \
+	{ \
+		unsigned char *input_row = input_rows[i + in_y]; \
+		kernels->rgb_to_y_row(&tables, output_rows[0] + i * out_rowspan, \
+			input_row, 0, w); \
+		if(!uv_shift || (i & 1) || (i == h - 1)) \
+			rgb_to_uv_row(&tables, \
+				output_rows[1] + (i >> uv_shift) * out_rowspan_uv, \
+				output_rows[2] + (i >> uv_shift) * out_rowspan_uv, \
+				input_row, w); \
+	} \
+}
+
+RGB_TO_YUV_FUNC(rgb888_to_yuv420p,  rgb_to_yuv,  1)
+RGB_TO_YUV_FUNC(rgb888_to_yuvj420p, rgb_to_yuvj, 1)
+RGB_TO_YUV_FUNC(rgb888_to_yuv422p,  rgb_to_yuv,  0)
+RGB_TO_YUV_FUNC(rgb888_to_yuvj422p, rgb_to_yuvj, 0)
+
+static void yuv422_to_yuv422p(unsigned char **output_rows,
+	unsigned char **input_rows,
+	int in_y,
+	int w,
+	int h,
+	int start,
+	int end,
+	int in_rowspan,
+	int out_rowspan,
+	int in_rowspan_uv,
+	int out_rowspan_uv)
+{
+	int i;
+	for(i = start; i < end; i++)
+	{
+		kernels->yuv422_split_row(output_rows[0] + i * out_rowspan,
+			output_rows[1] + i * out_rowspan_uv,
+			output_rows[2] + i * out_rowspan_uv,
+			input_rows[i + in_y], 0, w);
+	}
+}
+
+static void yuv422_to_yuv420p(unsigned char **output_rows,
+	unsigned char **input_rows,
+	int in_y,
+	int w,
+	int h,
+	int start,
+	int end,
+	int in_rowspan,
+	int out_rowspan,
+	int in_rowspan_uv,
+	int out_rowspan_uv)
+{
+	int i;
+	for(i = start; i < end; i++)
+	{
+/* Chroma is taken from the even rows */
+		if(!(i & 1))
+			kernels->yuv422_split_row(output_rows[0] + i * out_rowspan,
+				output_rows[1] + i / 2 * out_rowspan_uv,
+				output_rows[2] + i / 2 * out_rowspan_uv,
+				input_rows[i + in_y], 0, w);
+		else
+			kernels->yuv422_y_row(output_rows[0] + i * out_rowspan,
+				input_rows[i + in_y], 0, w);
+	}
+}
+
+cmodel_fast_func cmodel_fast_get(int in_colormodel, int out_colormodel)
+{
+	pthread_once(&kernels_once, init_kernels);
+
+	switch(in_colormodel)
+	{
+		case BC_YUV420P:
+			switch(out_colormodel)
+			{
+				case BC_RGB888:   return yuv420p_to_rgb888;
+				case BC_RGBA8888: return yuv420p_to_rgba8888;
+			}
+			break;
+		case BC_YUVJ420P:
+			switch(out_colormodel)
+			{
+				case BC_RGB888:   return yuvj420p_to_rgb888;
+				case BC_RGBA8888: return yuvj420p_to_rgba8888;
+			}
+			break;
+		case BC_YUV422P:
+			switch(out_colormodel)
+			{
+				case BC_RGB888:   return yuv422p_to_rgb888;
+				case BC_RGBA8888: return yuv422p_to_rgba8888;
+			}
+			break;
+		case BC_YUVJ422P:
+			switch(out_colormodel)
+			{
+				case BC_RGB888:   return yuvj422p_to_rgb888;
+				case BC_RGBA8888: return yuvj422p_to_rgba8888;
+			}
+			break;
+		case BC_RGB888:
+			switch(out_colormodel)
+			{
+				case BC_YUV420P:  return rgb888_to_yuv420p;
+				case BC_YUVJ420P: return rgb888_to_yuvj420p;
+				case BC_YUV422P:  return rgb888_to_yuv422p;
+				case BC_YUVJ422P: return rgb888_to_yuvj422p;
+			}
+			break;
+		case BC_YUV422:
+			switch(out_colormodel)
+			{
+				case BC_YUV422P:  return yuv422_to_yuv422p;
+				case BC_YUV420P:  return yuv422_to_yuv420p;
+			}
+			break;
+	}
+	return NULL;
+}
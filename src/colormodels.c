@@ -110,36 +110,135 @@ static void get_scale_tables(int **column_table,
 	}
 }
 
-void cmodel_transfer(unsigned char **output_rows, 
-	unsigned char **input_rows,
-	int in_x, 
-	int in_y, 
-	int in_w, 
+/*
+ *  A plan holds everything which depends only on the conversion
+ *  parameters, so converting many frames with the same parameters
+ *  needs no allocations.
+ */
+
+struct lqt_cmodel_plan_s
+{
+	int in_x;
+	int in_y;
+	int in_w;
+	int in_h;
+	int out_w;
+	int out_h;
+	int in_colormodel;
+	int out_colormodel;
+	int in_rowspan;
+	int out_rowspan;
+	int in_rowspan_uv;
+	int out_rowspan_uv;
+
+	int in_pixelsize;
+	int out_pixelsize;
+	int scale;
+
+/* Row kernel for unscaled conversions, NULL if the generic code is used */
+	cmodel_fast_func fast;
+
+	int *column_table;
+	int *row_table;
+};
+
+static void plan_init(lqt_cmodel_plan_t *plan,
+	int in_x,
+	int in_y,
+	int in_w,
 	int in_h,
-	int out_w, 
+	int out_w,
 	int out_h,
-	int in_colormodel, 
+	int in_colormodel,
 	int out_colormodel,
 	int in_rowspan,
-        int out_rowspan,
+	int out_rowspan,
 	int in_rowspan_uv,
 	int out_rowspan_uv)
 {
-	int *column_table;
-	int *row_table;
-	int scale;
-	int in_pixelsize = cmodel_calculate_pixelsize(in_colormodel);
-	int out_pixelsize = cmodel_calculate_pixelsize(out_colormodel);
+	plan->in_x = in_x;
+	plan->in_y = in_y;
+	plan->in_w = in_w;
+	plan->in_h = in_h;
+	plan->out_w = out_w;
+	plan->out_h = out_h;
+	plan->in_colormodel = in_colormodel;
+	plan->out_colormodel = out_colormodel;
+	plan->in_rowspan = in_rowspan;
+	plan->out_rowspan = out_rowspan;
+	plan->in_rowspan_uv = in_rowspan_uv;
+	plan->out_rowspan_uv = out_rowspan_uv;
+
+	plan->in_pixelsize = cmodel_calculate_pixelsize(in_colormodel);
+	plan->out_pixelsize = cmodel_calculate_pixelsize(out_colormodel);
+	plan->scale = 0;
+	plan->column_table = NULL;
+	plan->row_table = NULL;
+
+// Unscaled conversions with a row kernel
+	plan->fast = NULL;
+	if(!in_x && (in_w == out_w) && (in_h == out_h))
+		plan->fast = cmodel_fast_get(in_colormodel, out_colormodel);
+	if(plan->fast)
+		return;
 
 // Get scaling
-	scale = (out_w != in_w) || (in_x != 0);
-	get_scale_tables(&column_table, &row_table, 
+	plan->scale = (out_w != in_w) || (in_x != 0);
+	get_scale_tables(&plan->column_table, &plan->row_table,
 		in_x, in_y, in_x + in_w, in_y + in_h,
 		0, 0, out_w, out_h);
+}
+
+static void plan_free(lqt_cmodel_plan_t *plan)
+{
+	if(plan->column_table)
+		free(plan->column_table);
+	if(plan->row_table)
+		free(plan->row_table);
+}
+
+/* Convert the output rows start..end-1 */
+
+static void plan_transfer(lqt_cmodel_plan_t *plan,
+	unsigned char **output_rows,
+	unsigned char **input_rows,
+	int start,
+	int end)
+{
+	unsigned char *planes[3];
+	int *row_table;
+	int out_h;
+	int sub_h, sub_v;
 
+	if(plan->fast)
+	{
+		plan->fast(output_rows, input_rows, plan->in_y,
+			plan->out_w, plan->out_h, start, end,
+			plan->in_rowspan, plan->out_rowspan,
+			plan->in_rowspan_uv, plan->out_rowspan_uv);
+		return;
+	}
+
+// The generic code always starts at output row 0
+	row_table = plan->row_table + start;
+	out_h = end - start;
+
+	if(start)
+	{
+		if(cmodel_is_planar(plan->out_colormodel))
+		{
+			lqt_colormodel_get_chroma_sub(plan->out_colormodel, &sub_h, &sub_v);
+			planes[0] = output_rows[0] + start * plan->out_rowspan;
+			planes[1] = output_rows[1] + (start / sub_v) * plan->out_rowspan_uv;
+			planes[2] = output_rows[2] + (start / sub_v) * plan->out_rowspan_uv;
+			output_rows = planes;
+		}
+		else
+			output_rows += start;
+	}
 
 // Handle planar cmodels separately
-	switch(in_colormodel)
+	switch(plan->in_colormodel)
 	{
 		case BC_YUV420P:
 		case BC_YUV422P:
@@ -150,116 +249,230 @@ void cmodel_transfer(unsigned char **output_rows,
         case BC_YUVJ422P10:
  			cmodel_yuv420p(output_rows,  \
 				input_rows, \
-				in_x,  \
-				in_y,  \
-				in_w,  \
-				in_h, \
-				out_w,  \
+				plan->in_x,  \
+				plan->in_y,  \
+				plan->in_w,  \
+				plan->in_h, \
+				plan->out_w,  \
 				out_h, \
-				in_colormodel,  \
-				out_colormodel, \
-				in_rowspan, \
-				out_rowspan, \
-				in_rowspan_uv, \
-				out_rowspan_uv, \
-				scale, \
-				out_pixelsize, \
-				in_pixelsize, \
+				plan->in_colormodel,  \
+				plan->out_colormodel, \
+				plan->in_rowspan, \
+				plan->out_rowspan, \
+				plan->in_rowspan_uv, \
+				plan->out_rowspan_uv, \
+				plan->scale, \
+				plan->out_pixelsize, \
+				plan->in_pixelsize, \
 				row_table, \
-				column_table); \
+				plan->column_table); \
 			break; \
 		case BC_YUV411P:
  			cmodel_yuv411p(output_rows,  \
 				input_rows, \
-				in_x,  \
-				in_y,  \
-				in_w,  \
-				in_h, \
-				out_w,  \
+				plan->in_x,  \
+				plan->in_y,  \
+				plan->in_w,  \
+				plan->in_h, \
+				plan->out_w,  \
 				out_h, \
-				in_colormodel,  \
-				out_colormodel, \
-				in_rowspan, \
-				out_rowspan, \
-				in_rowspan_uv, \
-				out_rowspan_uv, \
-				scale, \
-				out_pixelsize, \
-				in_pixelsize, \
+				plan->in_colormodel,  \
+				plan->out_colormodel, \
+				plan->in_rowspan, \
+				plan->out_rowspan, \
+				plan->in_rowspan_uv, \
+				plan->out_rowspan_uv, \
+				plan->scale, \
+				plan->out_pixelsize, \
+				plan->in_pixelsize, \
 				row_table, \
-				column_table); \
+				plan->column_table); \
 			break; \
                 case BC_YUV444P:
                 case BC_YUV444P16:
                 case BC_YUVJ444P:
                         cmodel_yuv444p(output_rows,  \
                                 input_rows, \
-                                in_x,  \
-                                in_y,  \
-                                in_w,  \
-                                in_h, \
-                                out_w,  \
+                                plan->in_x,  \
+                                plan->in_y,  \
+                                plan->in_w,  \
+                                plan->in_h, \
+                                plan->out_w,  \
                                 out_h, \
-                                in_colormodel,  \
-                                out_colormodel, \
-                                in_rowspan, \
-                                out_rowspan, \
-                                in_rowspan_uv, \
-                                out_rowspan_uv, \
-                                scale, \
-                                out_pixelsize, \
-                                in_pixelsize, \
+                                plan->in_colormodel,  \
+                                plan->out_colormodel, \
+                                plan->in_rowspan, \
+                                plan->out_rowspan, \
+                                plan->in_rowspan_uv, \
+                                plan->out_rowspan_uv, \
+                                plan->scale, \
+                                plan->out_pixelsize, \
+                                plan->in_pixelsize, \
                                 row_table, \
-                                column_table); \
+                                plan->column_table); \
                         break;
 
 		case BC_YUV422:
 			cmodel_yuv422(output_rows,  \
 				input_rows, \
-				in_x,  \
-				in_y,  \
-				in_w,  \
-				in_h, \
-				out_w,  \
+				plan->in_x,  \
+				plan->in_y,  \
+				plan->in_w,  \
+				plan->in_h, \
+				plan->out_w,  \
 				out_h, \
-				in_colormodel,  \
-				out_colormodel, \
-				in_rowspan, \
-				out_rowspan, \
-				in_rowspan_uv, \
-				out_rowspan_uv, \
-				scale, \
-				out_pixelsize, \
-				in_pixelsize, \
+				plan->in_colormodel,  \
+				plan->out_colormodel, \
+				plan->in_rowspan, \
+				plan->out_rowspan, \
+				plan->in_rowspan_uv, \
+				plan->out_rowspan_uv, \
+				plan->scale, \
+				plan->out_pixelsize, \
+				plan->in_pixelsize, \
 				row_table, \
-				column_table);
+				plan->column_table);
 			break;
 
 		default:
 			cmodel_default(output_rows,  \
 				input_rows, \
-				in_x,  \
-				in_y,  \
-				in_w,  \
-				in_h, \
-				out_w,  \
+				plan->in_x,  \
+				plan->in_y,  \
+				plan->in_w,  \
+				plan->in_h, \
+				plan->out_w,  \
 				out_h, \
-				in_colormodel,  \
-				out_colormodel, \
-				in_rowspan, \
-				out_rowspan, \
-				in_rowspan_uv, \
-				out_rowspan_uv, \
-				scale, \
-				out_pixelsize, \
-				in_pixelsize, \
+				plan->in_colormodel,  \
+				plan->out_colormodel, \
+				plan->in_rowspan, \
+				plan->out_rowspan, \
+				plan->in_rowspan_uv, \
+				plan->out_rowspan_uv, \
+				plan->scale, \
+				plan->out_pixelsize, \
+				plan->in_pixelsize, \
 				row_table, \
-				column_table);
+				plan->column_table);
 			break;
 	}
 
-	free(column_table);
-	free(row_table);
+}
+
+void cmodel_transfer(unsigned char **output_rows,
+	unsigned char **input_rows,
+	int in_x,
+	int in_y,
+	int in_w,
+	int in_h,
+	int out_w,
+	int out_h,
+	int in_colormodel,
+	int out_colormodel,
+	int in_rowspan,
+        int out_rowspan,
+	int in_rowspan_uv,
+	int out_rowspan_uv)
+{
+	lqt_cmodel_plan_t plan;
+
+	plan_init(&plan, in_x, in_y, in_w, in_h, out_w, out_h,
+		in_colormodel, out_colormodel,
+		in_rowspan, out_rowspan, in_rowspan_uv, out_rowspan_uv);
+	plan_transfer(&plan, output_rows, input_rows, 0, out_h);
+	plan_free(&plan);
+}
+
+lqt_cmodel_plan_t * lqt_cmodel_plan_update(lqt_cmodel_plan_t *plan,
+	int in_x,
+	int in_y,
+	int in_w,
+	int in_h,
+	int out_w,
+	int out_h,
+	int in_colormodel,
+	int out_colormodel,
+	int in_rowspan,
+	int out_rowspan,
+	int in_rowspan_uv,
+	int out_rowspan_uv)
+{
+	if(plan)
+	{
+		if((plan->in_x == in_x) &&
+		   (plan->in_y == in_y) &&
+		   (plan->in_w == in_w) &&
+		   (plan->in_h == in_h) &&
+		   (plan->out_w == out_w) &&
+		   (plan->out_h == out_h) &&
+		   (plan->in_colormodel == in_colormodel) &&
+		   (plan->out_colormodel == out_colormodel) &&
+		   (plan->in_rowspan == in_rowspan) &&
+		   (plan->out_rowspan == out_rowspan) &&
+		   (plan->in_rowspan_uv == in_rowspan_uv) &&
+		   (plan->out_rowspan_uv == out_rowspan_uv))
+			return plan;
+		plan_free(plan);
+	}
+	else
+		plan = malloc(sizeof(*plan));
+
+	plan_init(plan, in_x, in_y, in_w, in_h, out_w, out_h,
+		in_colormodel, out_colormodel,
+		in_rowspan, out_rowspan, in_rowspan_uv, out_rowspan_uv);
+	return plan;
+}
+
+/* Slices for threads have an even number of rows, so the 2 luma rows
+   of a chroma row are converted by the same thread */
+
+#define MIN_SLICE_ROWS 16
+
+typedef struct
+{
+	lqt_cmodel_plan_t *plan;
+	unsigned char **output_rows;
+	unsigned char **input_rows;
+} slice_job_t;
+
+static void slice_func(void *data, int job, int num_jobs)
+{
+	slice_job_t *j = data;
+	int h = j->plan->out_h;
+	int start = (h * job / num_jobs) & ~1;
+	int end = (job == num_jobs - 1) ? h : (h * (job + 1) / num_jobs) & ~1;
+
+	plan_transfer(j->plan, j->output_rows, j->input_rows, start, end);
+}
+
+void lqt_cmodel_plan_transfer(lqt_cmodel_plan_t *plan,
+	unsigned char **output_rows,
+	unsigned char **input_rows,
+	quicktime_thread_pool_t *pool)
+{
+	slice_job_t j;
+	int num_jobs;
+
+	num_jobs = pool ? quicktime_thread_pool_threads(pool) : 1;
+	if(num_jobs > plan->out_h / MIN_SLICE_ROWS)
+		num_jobs = plan->out_h / MIN_SLICE_ROWS;
+
+	if(num_jobs < 2)
+	{
+		plan_transfer(plan, output_rows, input_rows, 0, plan->out_h);
+		return;
+	}
+
+	j.plan = plan;
+	j.output_rows = output_rows;
+	j.input_rows = input_rows;
+	quicktime_thread_pool_run(pool, slice_func, &j, num_jobs);
+}
+
+void lqt_cmodel_plan_destroy(lqt_cmodel_plan_t *plan)
+{
+	plan_free(plan);
+	free(plan);
 }
 
 int cmodel_bc_to_x(int color_model)
@@ -208,6 +208,119 @@ int lqt_read_video_packet(quicktime_t * file, lqt_packet_t * p, int track)
   return 1;
   }
 
+/* Interleaved reading */
+
+/* Find the audio or video track belonging to a trak */
+
+static lqt_track_type_t find_track(quicktime_t * file, int trak, int * track)
+  {
+  int i;
+  for(i = 0; i < file->total_vtracks; i++)
+    {
+    if(file->vtracks[i].track == file->moov.trak[trak])
+      {
+      *track = i;
+      return LQT_TRACK_VIDEO;
+      }
+    }
+  for(i = 0; i < file->total_atracks; i++)
+    {
+    if(file->atracks[i].track == file->moov.trak[trak])
+      {
+      *track = i;
+      return LQT_TRACK_AUDIO;
+      }
+    }
+  return LQT_TRACK_NONE;
+  }
+
+/* Check if all packets of a chunk were read already.
+   quicktime_sample_of_chunk() counts chunks starting with 1.
+   Chunks of tracks, which failed before, count as done. */
+
+static int chunk_done(quicktime_t * file, lqt_track_type_t type,
+                      int track, long chunk)
+  {
+  quicktime_audio_map_t *atrack;
+  quicktime_video_map_t *vtrack;
+  
+  if(type == LQT_TRACK_VIDEO)
+    {
+    vtrack = &file->vtracks[track];
+    if(vtrack->packets_failed)
+      return 1;
+    return vtrack->current_position >=
+      quicktime_sample_of_chunk(vtrack->track, chunk + 1) +
+      quicktime_chunk_samples(vtrack->track, chunk);
+    }
+  else if(type == LQT_TRACK_AUDIO)
+    {
+    atrack = &file->atracks[track];
+    if(atrack->packets_failed)
+      return 1;
+    if(atrack->codec->read_packet || atrack->block_align)
+      return atrack->cur_chunk > chunk;
+    else if(lqt_audio_is_vbr(file, track))
+      {
+      if(atrack->cur_chunk > chunk)
+        return 1;
+      return (atrack->cur_chunk == chunk) &&
+        atrack->total_vbr_packets &&
+        (atrack->cur_vbr_packet >= atrack->total_vbr_packets);
+      }
+    }
+  /* Track can't be read as packets */
+  return 1;
+  }
+
+int lqt_read_next_packet(quicktime_t * file, lqt_track_type_t * type,
+                         int * track, lqt_packet_t * p)
+  {
+  long i;
+  int ret = 0;
+  quicktime_chunk_map_t * c;
+  
+  if(!quicktime_build_chunk_map(file))
+    return 0;
+  
+  for(i = file->chunk_map_pos; i < file->chunk_map_size; i++)
+    {
+    c = &file->chunk_map[i];
+    
+    *type = find_track(file, c->trak, track);
+
+    if(chunk_done(file, *type, *track, c->chunk))
+      {
+      /* Skip finished chunks for the next calls as well */
+      if(i == file->chunk_map_pos)
+        file->chunk_map_pos++;
+      continue;
+      }
+    
+    if(*type == LQT_TRACK_VIDEO)
+      ret = lqt_read_video_packet(file, p, *track);
+    else
+      ret = lqt_read_audio_packet(file, p, *track);
+    
+    if(ret)
+      break;
+
+    /* Finished or broken track, skip it until the next seek
+       and try the others */
+    if(*type == LQT_TRACK_VIDEO)
+      file->vtracks[*track].packets_failed = 1;
+    else
+      file->atracks[*track].packets_failed = 1;
+
+    if(i == file->chunk_map_pos)
+      file->chunk_map_pos++;
+    }
+  
+  if(!ret)
+    *type = LQT_TRACK_NONE;
+  return ret;
+  }
+
 /* Writing */
 
 int lqt_writes_compressed(lqt_file_type_t type,
@@ -344,6 +457,9 @@ int lqt_write_video_packet(quicktime_t * file,
   lqt_start_encoding(file);
   
   /* Must set valid timestamp for encoders */
+
+  /* Needed for starting movie fragments */
+  vtrack->keyframe = !!(p->flags & LQT_PACKET_KEYFRAME);
   
   quicktime_write_chunk_header(file, vtrack->track);
   
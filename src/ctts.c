@@ -35,6 +35,56 @@ void quicktime_ctts_delete(quicktime_ctts_t *ctts)
   {
   if(ctts->table)
     free(ctts->table);
+  if(ctts->index_samples)
+    free(ctts->index_samples);
+  }
+
+void quicktime_ctts_build_index(quicktime_ctts_t *ctts)
+  {
+  long i;
+  
+  ctts->index_samples = malloc((ctts->total_entries + 1) * sizeof(*ctts->index_samples));
+  ctts->index_samples[0] = 0;
+  
+  for(i = 0; i < ctts->total_entries; i++)
+    ctts->index_samples[i+1] = ctts->index_samples[i] + ctts->table[i].sample_count;
+  }
+
+/* Get the ctts position of a sample and return its composition offset */
+
+int64_t quicktime_sample_to_ctts(quicktime_ctts_t *ctts, int64_t sample,
+                                 int64_t * ctts_index, int64_t * ctts_count)
+  {
+  int64_t sample_count = 0;
+  
+  if(!ctts->total_entries)
+    {
+    *ctts_index = 0;
+    *ctts_count = 0;
+    return 0;
+    }
+
+  if(ctts->index_samples)
+    {
+    *ctts_index = quicktime_stts_find(ctts->index_samples, ctts->total_entries,
+                                      sample, 0);
+    if(*ctts_index >= ctts->total_entries)
+      *ctts_index = ctts->total_entries - 1;
+    sample_count = ctts->index_samples[*ctts_index];
+    }
+  else
+    {
+    *ctts_index = 0;
+    while((*ctts_index < ctts->total_entries - 1) &&
+          (sample_count + ctts->table[*ctts_index].sample_count <= sample))
+      {
+      sample_count += ctts->table[*ctts_index].sample_count;
+      (*ctts_index)++;
+      }
+    }
+  
+  *ctts_count = sample - sample_count;
+  return ctts->table[*ctts_index].sample_duration;
   }
 
 void quicktime_ctts_dump(quicktime_ctts_t *ctts)
@@ -85,18 +135,47 @@ void quicktime_write_ctts(quicktime_t *file, quicktime_ctts_t *ctts)
 
   }
 
+/* Run length encoded on the fly like stts (see
+   quicktime_update_stts()) */
+
 void quicktime_update_ctts(quicktime_ctts_t *ctts, long sample, long duration)
   {
-  if(sample >= ctts->entries_allocated)
+  quicktime_ctts_table_t * last;
+  
+  sample -= ctts->index_base;
+
+  if(sample < ctts->num_samples)
     {
-    ctts->entries_allocated = sample + 1024;
-    ctts->table = realloc(ctts->table, ctts->entries_allocated * sizeof(*(ctts->table)));
+    if(sample < ctts->num_samples - 1)
+      return;
+    
+    /* Remove the last sample */
+    last = &ctts->table[ctts->total_entries-1];
+    if(last->sample_duration == duration)
+      return;
+    
+    last->sample_count--;
+    if(!last->sample_count)
+      ctts->total_entries--;
+    ctts->num_samples--;
     }
-  ctts->table[sample].sample_count = 1;
-  ctts->table[sample].sample_duration = duration;
   
-  if(sample >= ctts->total_entries)
-    ctts->total_entries = sample + 1;
+  if(ctts->total_entries &&
+     (ctts->table[ctts->total_entries-1].sample_duration == duration))
+    ctts->table[ctts->total_entries-1].sample_count++;
+  else
+    {
+    if(ctts->total_entries >= ctts->entries_allocated)
+      {
+      ctts->entries_allocated = ctts->entries_allocated * 2 + 16;
+      ctts->table = realloc(ctts->table,
+                            ctts->entries_allocated * sizeof(*(ctts->table)));
+      }
+    ctts->table[ctts->total_entries].sample_count = 1;
+    ctts->table[ctts->total_entries].sample_duration = duration;
+    ctts->total_entries++;
+    }
+  ctts->num_samples++;
   }
 
 void quicktime_compress_ctts(quicktime_ctts_t *ctts)
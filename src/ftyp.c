@@ -105,6 +105,7 @@ void quicktime_ftyp_init(quicktime_ftyp_t * ftyp, lqt_file_type_t type)
       copy_ftyp(ftyp, &ftyp_qt);
       return;
     case LQT_FILE_MP4:
+    case LQT_FILE_MP4_FRAGMENTED:
       copy_ftyp(ftyp, &ftyp_mp4);
       return;
     case LQT_FILE_M4A:
@@ -32,6 +32,11 @@
 
 #define LOG_DOMAIN "codecs"
 
+/* Size of the timestamp hash, must be a power of 2. Encoders delay
+   pictures by far less than this */
+#define PTS_HASH_BITS 8
+#define PTS_HASH_SIZE (1 << PTS_HASH_BITS)
+
 static int quicktime_delete_codec_stub(quicktime_codec_t *codec)
   {
   lqt_log(NULL, LQT_LOG_WARNING, LOG_DOMAIN,
@@ -323,6 +328,51 @@ static void set_default_rowspan(quicktime_t *file, int track)
                           &file->vtracks[track].io_row_span_uv);
   }
 
+/* Colorspace conversion with the cached plan of the track */
+
+static void transfer_frame(quicktime_video_map_t * vtrack,
+                           unsigned char **output_rows,
+                           unsigned char **input_rows,
+                           int in_x, int in_y, int in_w, int in_h,
+                           int out_w, int out_h,
+                           int in_colormodel, int out_colormodel,
+                           int in_rowspan, int out_rowspan,
+                           int in_rowspan_uv, int out_rowspan_uv)
+  {
+  vtrack->cmodel_plan =
+    lqt_cmodel_plan_update(vtrack->cmodel_plan,
+                           in_x, in_y, in_w, in_h, out_w, out_h,
+                           in_colormodel, out_colormodel,
+                           in_rowspan, out_rowspan,
+                           in_rowspan_uv, out_rowspan_uv);
+  lqt_cmodel_plan_transfer(vtrack->cmodel_plan, output_rows, input_rows,
+                           vtrack->thread_pool);
+  }
+
+/* Let the decoder output io_cmodel directly if it can */
+
+static void set_decoding_cmodel(quicktime_video_map_t * vtrack)
+  {
+  int i;
+
+  if(!vtrack->decoding_cmodels)
+    return;
+
+  for(i = 0; vtrack->decoding_cmodels[i] != LQT_COLORMODEL_NONE; i++)
+    {
+    if(vtrack->decoding_cmodels[i] == vtrack->io_cmodel)
+      {
+      vtrack->stream_cmodel = vtrack->io_cmodel;
+      if(vtrack->temp_frame)
+        {
+        lqt_rows_free(vtrack->temp_frame);
+        vtrack->temp_frame = NULL;
+        }
+      return;
+      }
+    }
+  }
+
 /*
  *  Same as quicktime_decode_video but doesn't force BC_RGB888
  */
@@ -337,13 +387,17 @@ int lqt_decode_video(quicktime_t *file,
         
   height = quicktime_video_height(file, track);
   width =  quicktime_video_width(file, track);
-        
+
+  if(file->vtracks[track].io_cmodel != file->vtracks[track].stream_cmodel)
+    set_decoding_cmodel(&file->vtracks[track]);
+
   if(file->vtracks[track].io_cmodel != file->vtracks[track].stream_cmodel)
     {
     if(!file->vtracks[track].temp_frame)
       {
       file->vtracks[track].temp_frame =
-        lqt_rows_alloc(width, height, file->vtracks[track].stream_cmodel,
+        lqt_rows_alloc(width, height + file->vtracks[track].height_extension,
+                       file->vtracks[track].stream_cmodel,
                        &file->vtracks[track].stream_row_span,
                        &file->vtracks[track].stream_row_span_uv);
       }
@@ -351,20 +405,21 @@ int lqt_decode_video(quicktime_t *file,
       file->vtracks[track].codec->decode_video(file,
                                                file->vtracks[track].temp_frame,
                                                track);
-    cmodel_transfer(row_pointers,                    //    unsigned char **output_rows, /* Leave NULL if non existent */
-                    file->vtracks[track].temp_frame, //    unsigned char **input_rows,
-                    0, //                                  int in_x,        /* Dimensions to capture from input frame */
-                    0, //                                  int in_y, 
-                    width, //                              int in_w, 
-                    height + file->vtracks[track].height_extension, // int in_h,
-                    width, //                              int out_w,
-                    height + file->vtracks[track].height_extension, // int out_h,
-                    file->vtracks[track].stream_cmodel, // int in_colormodel,
-                    file->vtracks[track].io_cmodel,     // int out_colormodel,
-                    file->vtracks[track].stream_row_span,   /* For planar use the luma rowspan */
-                    file->vtracks[track].io_row_span,       /* For planar use the luma rowspan */
-                    file->vtracks[track].stream_row_span_uv, /* Chroma rowspan */
-                    file->vtracks[track].io_row_span_uv      /* Chroma rowspan */);
+    transfer_frame(&file->vtracks[track],
+                   row_pointers,                    //    unsigned char **output_rows, /* Leave NULL if non existent */
+                   file->vtracks[track].temp_frame, //    unsigned char **input_rows,
+                   0, //                                  int in_x,        /* Dimensions to capture from input frame */
+                   0, //                                  int in_y, 
+                   width, //                              int in_w, 
+                   height + file->vtracks[track].height_extension, // int in_h,
+                   width, //                              int out_w,
+                   height + file->vtracks[track].height_extension, // int out_h,
+                   file->vtracks[track].stream_cmodel, // int in_colormodel,
+                   file->vtracks[track].io_cmodel,     // int out_colormodel,
+                   file->vtracks[track].stream_row_span,   /* For planar use the luma rowspan */
+                   file->vtracks[track].io_row_span,       /* For planar use the luma rowspan */
+                   file->vtracks[track].stream_row_span_uv, /* Chroma rowspan */
+                   file->vtracks[track].io_row_span_uv      /* Chroma rowspan */);
          
     }
   else
@@ -424,20 +479,21 @@ long quicktime_decode_scaled(quicktime_t *file,
     file->vtracks[track].codec->decode_video(file,
                                              file->vtracks[track].temp_frame,
                                              track);
-  cmodel_transfer(row_pointers,                    //    unsigned char **output_rows, /* Leave NULL if non existent */
-                  file->vtracks[track].temp_frame, //    unsigned char **input_rows,
-                  in_x, //                               int in_x,        /* Dimensions to capture from input frame */
-                  in_y, //                               int in_y, 
-                  in_w, //                               int in_w, 
-                  in_h, //                               int in_h,
-                  out_w, //                              int out_w, 
-                  out_h, //                              int out_h,
-                  file->vtracks[track].stream_cmodel, // int in_colormodel, 
-                  file->vtracks[track].io_cmodel,     // int out_colormodel,
-                  file->vtracks[track].stream_row_span,   /* For planar use the luma rowspan */
-                  file->vtracks[track].io_row_span,       /* For planar use the luma rowspan */
-                  file->vtracks[track].stream_row_span_uv, /* Chroma rowspan */
-                  file->vtracks[track].io_row_span_uv      /* Chroma rowspan */);
+  transfer_frame(&file->vtracks[track],
+                 row_pointers,                    //    unsigned char **output_rows, /* Leave NULL if non existent */
+                 file->vtracks[track].temp_frame, //    unsigned char **input_rows,
+                 in_x, //                               int in_x,        /* Dimensions to capture from input frame */
+                 in_y, //                               int in_y, 
+                 in_w, //                               int in_w, 
+                 in_h, //                               int in_h,
+                 out_w, //                              int out_w, 
+                 out_h, //                              int out_h,
+                 file->vtracks[track].stream_cmodel, // int in_colormodel, 
+                 file->vtracks[track].io_cmodel,     // int out_colormodel,
+                 file->vtracks[track].stream_row_span,   /* For planar use the luma rowspan */
+                 file->vtracks[track].io_row_span,       /* For planar use the luma rowspan */
+                 file->vtracks[track].stream_row_span_uv, /* Chroma rowspan */
+                 file->vtracks[track].io_row_span_uv      /* Chroma rowspan */);
         
   lqt_update_frame_position(&file->vtracks[track]);
   return result;
@@ -514,20 +570,21 @@ static int do_encode_video(quicktime_t *file,
                        &file->vtracks[track].stream_row_span,
                        &file->vtracks[track].stream_row_span_uv);
       }
-    cmodel_transfer(file->vtracks[track].temp_frame, //    unsigned char **output_rows, /* Leave NULL if non existent */
-                    row_pointers,                    //    unsigned char **input_rows,
-                    0, //                                  int in_x,        /* Dimensions to capture from input frame */
-                    0, //                                  int in_y, 
-                    width, //                              int in_w, 
-                    height + file->vtracks[track].height_extension, // int in_h,
-                    width, //                              int out_w, 
-                    height + file->vtracks[track].height_extension, // int out_h,
-                    file->vtracks[track].io_cmodel, // int in_colormodel, 
-                    file->vtracks[track].stream_cmodel,     // int out_colormodel,
-                    file->vtracks[track].io_row_span,   /* For planar use the luma rowspan */
-                    file->vtracks[track].stream_row_span,       /* For planar use the luma rowspan */
-                    file->vtracks[track].io_row_span_uv, /* Chroma rowspan */
-                    file->vtracks[track].stream_row_span_uv      /* Chroma rowspan */);
+    transfer_frame(&file->vtracks[track],
+                   file->vtracks[track].temp_frame, //    unsigned char **output_rows, /* Leave NULL if non existent */
+                   row_pointers,                    //    unsigned char **input_rows,
+                   0, //                                  int in_x,        /* Dimensions to capture from input frame */
+                   0, //                                  int in_y, 
+                   width, //                              int in_w, 
+                   height + file->vtracks[track].height_extension, // int in_h,
+                   width, //                              int out_w, 
+                   height + file->vtracks[track].height_extension, // int out_h,
+                   file->vtracks[track].io_cmodel, // int in_colormodel, 
+                   file->vtracks[track].stream_cmodel,     // int out_colormodel,
+                   file->vtracks[track].io_row_span,   /* For planar use the luma rowspan */
+                   file->vtracks[track].stream_row_span,       /* For planar use the luma rowspan */
+                   file->vtracks[track].io_row_span_uv, /* Chroma rowspan */
+                   file->vtracks[track].stream_row_span_uv      /* Chroma rowspan */);
     result = file->vtracks[track].codec->encode_video(file, file->vtracks[track].temp_frame, track);
     }
   else
@@ -539,12 +596,20 @@ static int do_encode_video(quicktime_t *file,
   return result;
   }
 
+static int pts_hash(int64_t pts)
+  {
+  /* Fibonacci hashing: Timestamps are usually multiples of the
+     frame duration */
+  return ((uint64_t)pts * 0x9E3779B97F4A7C15ULL) >> (64 - PTS_HASH_BITS);
+  }
+
 void lqt_write_frame_header(quicktime_t * file, int track,
                             int pic_num1,
                             int64_t pic_pts, int keyframe)
   {
   quicktime_video_map_t * vtrack = &file->vtracks[track];
   quicktime_trak_t * trak = vtrack->track;
+  quicktime_pts_hash_t * h;
   int pic_num = -1;
   int i;
   
@@ -554,13 +619,29 @@ void lqt_write_frame_header(quicktime_t * file, int track,
     pic_num = pic_num1;
   else
     {
-    /* We start at current_position because this isn't incremented by now */
-    for(i = vtrack->current_position; i >= 0; i--)
+    /* Recently appended pictures are found in the hash */
+    if(vtrack->pts_hash)
       {
-      if(vtrack->timestamps[i] == pic_pts)
+      h = vtrack->pts_hash + pts_hash(pic_pts);
+      if((h->pic_num >= 0) &&
+         (h->pts == pic_pts) &&
+         (h->pic_num >= vtrack->timestamps_start) &&
+         (h->pic_num <= vtrack->current_position) &&
+         (vtrack->timestamps[h->pic_num - vtrack->timestamps_start] == pic_pts))
+        pic_num = h->pic_num;
+      }
+
+    /* Hash collision: Search backwards. We start at current_position
+       because this isn't incremented by now */
+    if(pic_num < 0)
+      {
+      for(i = vtrack->current_position; i >= vtrack->timestamps_start; i--)
         {
-        pic_num = i;
-        break;
+        if(vtrack->timestamps[i - vtrack->timestamps_start] == pic_pts)
+          {
+          pic_num = i;
+          break;
+          }
         }
       }
     }
@@ -568,14 +649,16 @@ void lqt_write_frame_header(quicktime_t * file, int track,
   //  if(pic_num < 0)
   //    fprintf(stderr, "Picture number not found\n");
   
-  if(vtrack->cur_chunk >= vtrack->picture_numbers_alloc)
+  if(vtrack->cur_chunk - vtrack->picture_numbers_start >=
+     vtrack->picture_numbers_alloc)
     {
-    vtrack->picture_numbers_alloc += 1024;
+    vtrack->picture_numbers_alloc = vtrack->picture_numbers_alloc * 2 + 1024;
     vtrack->picture_numbers = realloc(vtrack->picture_numbers,
                                       sizeof(*vtrack->picture_numbers) *
                                       vtrack->picture_numbers_alloc);
     }
-  vtrack->picture_numbers[vtrack->cur_chunk] = pic_num;
+  vtrack->picture_numbers[vtrack->cur_chunk -
+                          vtrack->picture_numbers_start] = pic_num;
   vtrack->keyframe = keyframe;
   
   quicktime_write_chunk_header(file, trak);
@@ -703,20 +786,36 @@ void lqt_video_append_timestamp(quicktime_t * file, int track,
                                 int64_t time, int duration)
   {
   quicktime_video_map_t * vtrack = &file->vtracks[track];
+  quicktime_pts_hash_t * h;
+  int i;
   /* Update timestamp table */
 
   //  fprintf(stderr, "lqt_video_append_timestamp: %ld %d\n",
   //          time, duration);
 
-  if(vtrack->current_position >= vtrack->timestamps_alloc)
+  if(vtrack->current_position - vtrack->timestamps_start >=
+     vtrack->timestamps_alloc)
     {
-    vtrack->timestamps_alloc += 1024;
+    vtrack->timestamps_alloc = vtrack->timestamps_alloc * 2 + 1024;
     vtrack->timestamps = realloc(vtrack->timestamps,
                                  vtrack->timestamps_alloc *
                                  sizeof(*vtrack->timestamps));
     }
-  vtrack->timestamps[vtrack->current_position] = time;
+  vtrack->timestamps[vtrack->current_position - vtrack->timestamps_start] = time;
   vtrack->duration = time + duration;
+
+  if(!vtrack->pts_hash)
+    {
+    vtrack->pts_hash = malloc(PTS_HASH_SIZE * sizeof(*vtrack->pts_hash));
+    for(i = 0; i < PTS_HASH_SIZE; i++)
+      {
+      vtrack->pts_hash[i].pts = 0;
+      vtrack->pts_hash[i].pic_num = -1;
+      }
+    }
+  h = vtrack->pts_hash + pts_hash(time);
+  h->pts = time;
+  h->pic_num = vtrack->current_position;
   }
 
 
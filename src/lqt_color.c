@@ -372,6 +372,27 @@ lqt_get_best_source_colormodel(int const* source_options, int target)
   return ret;
   }
 
+/* First colormodel, which the decoder can output directly */
+
+static int get_decoding_colormodel(quicktime_video_map_t * vtrack,
+                                   int const* supported)
+  {
+  int i, j;
+
+  if(!vtrack->decoding_cmodels || !supported)
+    return LQT_COLORMODEL_NONE;
+
+  for(i = 0; vtrack->decoding_cmodels[i] != LQT_COLORMODEL_NONE; i++)
+    {
+    for(j = 0; supported[j] != LQT_COLORMODEL_NONE; j++)
+      {
+      if(supported[j] == vtrack->decoding_cmodels[i])
+        return supported[j];
+      }
+    }
+  return LQT_COLORMODEL_NONE;
+  }
+
 int lqt_get_best_colormodel(quicktime_t * file, int track,
                             int * supported)
   {
@@ -381,8 +402,18 @@ int lqt_get_best_colormodel(quicktime_t * file, int track,
   if(file->wr)
     ret = lqt_get_best_source_colormodel(supported, file->vtracks[track].stream_cmodel);
   else
+    {
     ret = lqt_get_best_target_colormodel(file->vtracks[track].stream_cmodel, supported);
 
+    /* Avoid the conversion after decoding if possible */
+    if(ret != file->vtracks[track].stream_cmodel)
+      {
+      int direct = get_decoding_colormodel(&file->vtracks[track], supported);
+      if(direct != LQT_COLORMODEL_NONE)
+        ret = direct;
+      }
+    }
+
   if(ret == LQT_COLORMODEL_NONE)
     {
     /* Backwards compatibility. */
@@ -1220,7 +1251,7 @@ int lqt_colormodel_has_conversion(int in_cmodel, int out_cmodel)
         case BC_RGBA16161616: return 0; break;
         case BC_YUVA8888:     return 0; break;
         case BC_YUV422:       return 0; break;
-        case BC_YUV420P:      return 0; break;
+        case BC_YUV420P:      return 1; break;
         case BC_YUV422P:      return 0; break;
         case BC_YUV444P:      return 0; break;
         case BC_YUV411P:      return 0; break;
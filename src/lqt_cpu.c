@@ -0,0 +1,87 @@
+/*******************************************************************************
+ lqt_cpu.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  CPU features for selecting optimized code at runtime.
+ *
+ *  The features are detected on first use. Code for instruction set
+ *  extensions is compiled with target attributes, so the same binary
+ *  runs on all CPUs of an architecture.
+ */
+
+#include "lqt_private.h"
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#define HAVE_CPUID
+#endif
+
+static int cpu_flags = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+#ifdef HAVE_CPUID
+
+/* Register state enabled by the operating system */
+
+static uint32_t xgetbv(void)
+  {
+  uint32_t eax, edx;
+  __asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+  return eax;
+  }
+
+#endif
+
+static void detect_cpu(void)
+  {
+#ifdef HAVE_CPUID
+  unsigned int eax, ebx, ecx, edx;
+
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return;
+
+  if(edx & bit_SSE2)
+    cpu_flags |= LQT_CPU_SSE2;
+  if(ecx & bit_SSSE3)
+    cpu_flags |= LQT_CPU_SSSE3;
+
+  /* AVX2 needs the OS to save the YMM registers */
+  if(!(ecx & bit_OSXSAVE) || ((xgetbv() & 0x06) != 0x06))
+    return;
+
+  if(__get_cpuid_max(0, NULL) < 7)
+    return;
+
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  if(ebx & bit_AVX2)
+    cpu_flags |= LQT_CPU_AVX2;
+#endif
+  }
+
+int quicktime_cpu_flags(void)
+  {
+  pthread_once(&cpu_once, detect_cpu);
+  return cpu_flags;
+  }
@@ -0,0 +1,1774 @@
+/*******************************************************************************
+ lqt_fragment.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Writing of fragmented MP4 files.
+ *
+ *  The file layout is:
+ *
+ *  ftyp moov moof mdat moof mdat ... mfra
+ *
+ *  Like in lqt_interleave.c, the data written between
+ *  quicktime_write_chunk_header() and quicktime_write_chunk_footer()
+ *  are appended to a buffer, which holds the media data of the current
+ *  fragment. quicktime_position() returns positions inside this buffer.
+ *  Chunks aren't added to the stco and stsc tables but are collected
+ *  here. The other sample tables (stsz, stts, ctts, stss) are filled by
+ *  the usual functions. When a fragment is finished, the moof atom
+ *  describing the samples of all tracks is written, followed by an mdat
+ *  atom with the buffered data. The data offsets are relative to the
+ *  moof atom (default-base-is-moof). Then the tables are emptied. Since
+ *  the index_base members of the tables are incremented, the functions
+ *  updating the tables can continue to use absolute sample numbers.
+ *
+ *  The moov atom is written before the first fragment, because the
+ *  codecs might need the first frames to complete the sample
+ *  descriptions. It has empty sample tables and an mvex atom.
+ *
+ *  Reading works the other way round: The trun atoms of all fragments
+ *  are appended to the usual sample tables (one chunk per trun), so
+ *  the rest of the library doesn't need to know about fragments.
+ *  Since the API reports track lengths directly after opening, all
+ *  fragments are indexed by quicktime_read_info(). To make this fast,
+ *  the positions of the moof atoms are taken from the sidx or mfra
+ *  atoms if possible. Then, only the moof atoms are read instead of
+ *  walking over all top level atoms of the file. The index is verified
+ *  with the decode times in the tfdt atoms, fragments, which are
+ *  missing in the index, are found by walking the atoms before them.
+ */
+
+#include "lqt_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_DOMAIN "fragment"
+
+/* Default fragment duration */
+#define DEFAULT_SECONDS 2.0
+
+/* Number of video timestamps, which are kept after a fragment is
+   written. Must be larger than the maximum reordering distance */
+#define REORDER_WINDOW 256
+
+/* tfhd flags */
+#define TFHD_BASE_DATA_OFFSET         0x000001
+#define TFHD_SAMPLE_DESCRIPTION_INDEX 0x000002
+#define TFHD_DEFAULT_SAMPLE_DURATION  0x000008
+#define TFHD_DEFAULT_SAMPLE_SIZE      0x000010
+#define TFHD_DEFAULT_SAMPLE_FLAGS     0x000020
+#define TFHD_DEFAULT_BASE_IS_MOOF     0x020000
+
+/* trun flags */
+#define TRUN_DATA_OFFSET              0x000001
+#define TRUN_FIRST_SAMPLE_FLAGS       0x000004
+#define TRUN_SAMPLE_DURATION          0x000100
+#define TRUN_SAMPLE_SIZE              0x000200
+#define TRUN_SAMPLE_FLAGS             0x000400
+#define TRUN_SAMPLE_CTS               0x000800
+
+/* Sample flags: sample_depends_on = 2 */
+#define SAMPLE_FLAGS_SYNC     0x02000000
+/* Sample flags: sample_depends_on = 1, sample_is_non_sync_sample = 1 */
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+/* sample_is_non_sync_sample */
+#define SAMPLE_FLAGS_NON_SYNC_BIT 0x00010000
+
+/* Maximum nesting depth of sidx atoms */
+#define MAX_SIDX_DEPTH 4
+
+typedef struct
+  {
+  int64_t offset;
+  int64_t size;
+  long samples;
+  } chunk_t;
+
+typedef struct
+  {
+  uint32_t size;
+  uint32_t duration;
+  int32_t cts;
+  uint32_t flags;
+  } sample_t;
+
+typedef struct
+  {
+  int64_t time;
+  int64_t moof_offset;
+  int traf_number;
+  } tfra_entry_t;
+
+typedef struct
+  {
+  quicktime_trak_t * trak;
+  quicktime_video_map_t * vtrack; /* Video tracks only */
+
+  /* Chunks since the last fragment */
+  chunk_t * chunks;
+  int num_chunks;
+  int chunks_alloc;
+
+  /* Samples of the current fragment */
+  sample_t * samples;
+  long num_samples;
+  long samples_alloc;
+
+  /* Constant framesize audio: One sample per chunk */
+  int per_chunk;
+
+  /* Samples in earlier fragments */
+  int64_t samples_flushed;
+
+  /* Decode time of the next fragment */
+  int64_t dts;
+  int64_t start_dts;
+  int dts_valid;
+
+  /* The codec marks keyframes */
+  int has_keyframes;
+
+  /* Random access points for the mfra */
+  tfra_entry_t * tfra;
+  int num_tfra;
+  int tfra_alloc;
+
+  /* Reading: Samples in the tables, nonzero if samples
+     weren't marked as sync samples in the stss table */
+  int64_t total_samples;
+  int has_non_sync;
+  int read_init;
+  } track_t;
+
+/* Defaults from the trex atoms */
+
+typedef struct
+  {
+  uint32_t track_id;
+  uint32_t sample_description_index;
+  uint32_t duration;
+  uint32_t size;
+  uint32_t flags;
+  } trex_t;
+
+/* Growing memory buffer for the moof and mfra atoms */
+
+typedef struct
+  {
+  uint8_t * data;
+  int64_t len;
+  int64_t alloc;
+  } buffer_t;
+
+struct quicktime_fragment_s
+  {
+  double seconds;
+  int64_t bytes;
+
+  track_t * tracks;
+  int num_tracks;
+
+  uint32_t sequence_number;
+
+  /* Start of the moov atom, 0 before the first fragment */
+  int64_t moov_start;
+  /* Position of the fragment_duration field of the mehd atom */
+  int64_t mehd_pos;
+
+  /* Time of the track, which starts the fragments */
+  int64_t start_time;
+  int started;
+
+  buffer_t buf;
+
+  /* Media data of the current fragment */
+  buffer_t mdat;
+  int in_chunk;
+
+  /* Positions of the data offsets of the trun atoms in buf */
+  int64_t * data_offsets;
+  int num_data_offsets;
+  int data_offsets_alloc;
+
+  /* Reading */
+  trex_t * trex;
+  int num_trex;
+
+  /* Positions of moof atoms from the sidx or mfra atoms */
+  int64_t * moofs;
+  int num_moofs;
+  int moofs_alloc;
+
+  /* Set after the first moof was found */
+  int indexed;
+
+  /* Set if the media data of a fragment is cut off. The samples
+     from there on are dropped. */
+  int truncated;
+  };
+
+/* Grow geometrically, the moof grows by a few bytes at a time
+   and the mdat by whole chunks */
+
+static void buffer_alloc(buffer_t * b, int64_t len)
+  {
+  if(b->len + len > b->alloc)
+    {
+    b->alloc = (b->len + len) * 2 + 4096;
+    b->data = realloc(b->data, b->alloc);
+    }
+  }
+
+static void put_32(buffer_t * b, uint32_t val)
+  {
+  buffer_alloc(b, 4);
+  b->data[b->len++] = (val >> 24) & 0xff;
+  b->data[b->len++] = (val >> 16) & 0xff;
+  b->data[b->len++] = (val >> 8) & 0xff;
+  b->data[b->len++] = val & 0xff;
+  }
+
+static void put_64(buffer_t * b, uint64_t val)
+  {
+  put_32(b, val >> 32);
+  put_32(b, val & 0xffffffff);
+  }
+
+static void put_fourcc(buffer_t * b, const char * fourcc)
+  {
+  buffer_alloc(b, 4);
+  memcpy(b->data + b->len, fourcc, 4);
+  b->len += 4;
+  }
+
+/* Atoms: Write a placeholder for the size and return the start */
+
+static int64_t start_atom(buffer_t * b, const char * type)
+  {
+  int64_t ret = b->len;
+  put_32(b, 0);
+  put_fourcc(b, type);
+  return ret;
+  }
+
+/* Overwrite a value written before */
+
+static void set_32(buffer_t * b, int64_t pos, uint32_t val)
+  {
+  b->data[pos]   = (val >> 24) & 0xff;
+  b->data[pos+1] = (val >> 16) & 0xff;
+  b->data[pos+2] = (val >> 8) & 0xff;
+  b->data[pos+3] = val & 0xff;
+  }
+
+static uint32_t get_32(buffer_t * b, int64_t pos)
+  {
+  return ((uint32_t)b->data[pos] << 24) | (b->data[pos+1] << 16) |
+    (b->data[pos+2] << 8) | b->data[pos+3];
+  }
+
+static void end_atom(buffer_t * b, int64_t start)
+  {
+  set_32(b, start, b->len - start);
+  }
+
+void quicktime_fragment_init(quicktime_t * file)
+  {
+  file->fragment = calloc(1, sizeof(*file->fragment));
+  file->fragment->seconds = DEFAULT_SECONDS;
+  }
+
+void quicktime_fragment_delete(quicktime_t * file)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  int i;
+
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    if(f->tracks[i].chunks)
+      free(f->tracks[i].chunks);
+    if(f->tracks[i].samples)
+      free(f->tracks[i].samples);
+    if(f->tracks[i].tfra)
+      free(f->tracks[i].tfra);
+    }
+  if(f->tracks)
+    free(f->tracks);
+  if(f->buf.data)
+    free(f->buf.data);
+  if(f->mdat.data)
+    free(f->mdat.data);
+  if(f->data_offsets)
+    free(f->data_offsets);
+  if(f->trex)
+    free(f->trex);
+  if(f->moofs)
+    free(f->moofs);
+  free(f);
+  file->fragment = NULL;
+  }
+
+void lqt_set_fragment_limits(quicktime_t * file, double seconds, int64_t bytes)
+  {
+  if(!file->fragment)
+    return;
+  file->fragment->seconds = seconds;
+  file->fragment->bytes = bytes;
+  }
+
+static track_t * get_track(quicktime_t * file, quicktime_trak_t * trak)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  int i, j;
+
+  if(f->num_tracks < file->moov.total_tracks)
+    {
+    f->tracks = realloc(f->tracks, file->moov.total_tracks * sizeof(*f->tracks));
+    memset(f->tracks + f->num_tracks, 0,
+           (file->moov.total_tracks - f->num_tracks) * sizeof(*f->tracks));
+
+    for(i = f->num_tracks; i < file->moov.total_tracks; i++)
+      {
+      f->tracks[i].trak = file->moov.trak[i];
+      for(j = 0; j < file->total_vtracks; j++)
+        {
+        if(file->vtracks[j].track == file->moov.trak[i])
+          f->tracks[i].vtrack = &file->vtracks[j];
+        }
+      }
+    f->num_tracks = file->moov.total_tracks;
+    }
+
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    if(f->tracks[i].trak == trak)
+      return &f->tracks[i];
+    }
+  return NULL;
+  }
+
+/* Media data are buffered between chunk header and footer */
+
+int64_t quicktime_fragment_start_chunk(quicktime_t * file)
+  {
+  file->fragment->in_chunk = 1;
+  return file->fragment->mdat.len;
+  }
+
+int quicktime_fragment_write(quicktime_t * file, const uint8_t * data, int size)
+  {
+  buffer_t * b = &file->fragment->mdat;
+
+  if(!file->fragment->in_chunk)
+    return 0;
+
+  buffer_alloc(b, size);
+  memcpy(b->data + b->len, data, size);
+  b->len += size;
+  return 1;
+  }
+
+int64_t quicktime_fragment_position(quicktime_t * file)
+  {
+  if(!file->fragment->in_chunk)
+    return -1;
+  return file->fragment->mdat.len;
+  }
+
+void quicktime_fragment_add_chunk(quicktime_t * file, quicktime_trak_t * trak,
+                                  int64_t offset, int64_t size, long samples)
+  {
+  track_t * t = get_track(file, trak);
+
+  file->fragment->in_chunk = 0;
+
+  if(!t || !samples)
+    return;
+
+  if(t->num_chunks >= t->chunks_alloc)
+    {
+    t->chunks_alloc += 256;
+    t->chunks = realloc(t->chunks, t->chunks_alloc * sizeof(*t->chunks));
+    }
+  t->chunks[t->num_chunks].offset = offset;
+  t->chunks[t->num_chunks].size = size;
+  t->chunks[t->num_chunks].samples = samples;
+  t->num_chunks++;
+  }
+
+/* Timestamp of a video picture */
+
+static int64_t picture_time(quicktime_video_map_t * vtrack, long pic)
+  {
+  return vtrack->timestamps[pic - vtrack->timestamps_start];
+  }
+
+/* Get the samples of the current fragment from the tables.
+   next_picture is 1 if the timestamp of the picture after the
+   last encoded one is known. */
+
+static void get_samples(quicktime_t * file, track_t * t, int next_picture)
+  {
+  quicktime_stbl_t * stbl = &t->trak->mdia.minf.stbl;
+  quicktime_video_map_t * vtrack = t->vtrack;
+  long i, j, k, num, pic;
+  int64_t dts, pts;
+  uint32_t duration;
+
+  /* Constant framesize audio has no sizes for single samples
+     (ima4 e.g. packs 64 samples into 34 bytes). Each chunk
+     becomes one sample with the exact size and the duration of
+     all samples in the chunk. */
+  t->per_chunk = !!stbl->stsz.sample_size;
+
+  if(t->per_chunk)
+    num = t->num_chunks;
+  else
+    {
+    num = 0;
+    for(i = 0; i < t->num_chunks; i++)
+      num += t->chunks[i].samples;
+    }
+
+  if(num > t->samples_alloc)
+    {
+    t->samples_alloc = num + 1024;
+    t->samples = realloc(t->samples, t->samples_alloc * sizeof(*t->samples));
+    }
+  memset(t->samples, 0, num * sizeof(*t->samples));
+  t->num_samples = num;
+
+  if(t->per_chunk)
+    {
+    if(!t->dts_valid)
+      {
+      t->dts = 0;
+      t->start_dts = 0;
+      t->dts_valid = 1;
+      }
+    duration = stbl->stts.total_entries ?
+      stbl->stts.table[0].sample_duration : 1;
+    for(i = 0; i < num; i++)
+      {
+      t->samples[i].size = t->chunks[i].size;
+      t->samples[i].duration = t->chunks[i].samples * duration;
+      t->samples[i].flags = SAMPLE_FLAGS_SYNC;
+      }
+    return;
+    }
+
+  /* Sizes */
+  for(i = 0; (i < num) && (i < stbl->stsz.total_entries); i++)
+    t->samples[i].size = stbl->stsz.table[i].size;
+
+  /* Durations and composition offsets */
+  if(vtrack && vtrack->picture_numbers)
+    {
+    /* Encoded video: Calculate everything from the picture numbers
+       and timestamps like lqt_video_build_timestamp_tables() does */
+    if(!t->dts_valid)
+      {
+      t->dts = picture_time(vtrack, vtrack->timestamps_start);
+      t->start_dts = t->dts;
+      t->dts_valid = 1;
+      }
+    dts = t->dts;
+
+    for(i = 0; i < num; i++)
+      {
+      pic = vtrack->picture_numbers[t->samples_flushed + i -
+                                    vtrack->picture_numbers_start];
+      if(pic < vtrack->timestamps_start)
+        {
+        /* Should never happen */
+        t->samples[i].duration = stbl->stts.default_duration;
+        continue;
+        }
+      pts = picture_time(vtrack, pic);
+
+      if(pic + 1 < vtrack->current_position + next_picture)
+        t->samples[i].duration = picture_time(vtrack, pic + 1) - pts;
+      else
+        t->samples[i].duration = vtrack->duration - pts;
+
+      if((int32_t)t->samples[i].duration <= 0)
+        t->samples[i].duration = stbl->stts.default_duration;
+
+      t->samples[i].cts = pts - dts;
+      dts += t->samples[i].duration;
+      }
+    }
+  else
+    {
+    if(!t->dts_valid)
+      {
+      t->dts = 0;
+      t->start_dts = 0;
+      t->dts_valid = 1;
+      }
+
+    j = 0;
+    k = 0;
+    for(i = 0; i < num; i++)
+      {
+      while((j < stbl->stts.total_entries) &&
+            (k >= stbl->stts.table[j].sample_count))
+        {
+        j++;
+        k = 0;
+        }
+      if(j < stbl->stts.total_entries)
+        {
+        t->samples[i].duration = stbl->stts.table[j].sample_duration;
+        k++;
+        }
+      else
+        t->samples[i].duration = stbl->stts.default_duration;
+      }
+
+    if(stbl->has_ctts)
+      {
+      j = 0;
+      k = 0;
+      for(i = 0; i < num; i++)
+        {
+        while((j < stbl->ctts.total_entries) &&
+              (k >= stbl->ctts.table[j].sample_count))
+          {
+          j++;
+          k = 0;
+          }
+        if(j >= stbl->ctts.total_entries)
+          break;
+        t->samples[i].cts = stbl->ctts.table[j].sample_duration;
+        k++;
+        }
+      }
+    }
+
+  /* Sync samples */
+  if(vtrack && (stbl->stss.total_entries || t->has_keyframes))
+    {
+    t->has_keyframes = 1;
+    for(i = 0; i < num; i++)
+      t->samples[i].flags = SAMPLE_FLAGS_NON_SYNC;
+    for(i = 0; i < stbl->stss.total_entries; i++)
+      {
+      k = stbl->stss.table[i].sample - 1 - t->samples_flushed;
+      if((k >= 0) && (k < num))
+        t->samples[k].flags = SAMPLE_FLAGS_SYNC;
+      }
+    }
+  else
+    {
+    for(i = 0; i < num; i++)
+      t->samples[i].flags = SAMPLE_FLAGS_SYNC;
+    }
+  }
+
+/* Remove the samples of the fragment from the tables. The chunks
+   are kept until the moof atom is written */
+
+static void clear_samples(quicktime_t * file, track_t * t)
+  {
+  quicktime_stbl_t * stbl = &t->trak->mdia.minf.stbl;
+  quicktime_video_map_t * vtrack = t->vtrack;
+  long keep, num;
+  int i;
+
+  for(i = 0; i < t->num_chunks; i++)
+    t->samples_flushed += t->chunks[i].samples;
+
+  if(!stbl->stsz.sample_size)
+    {
+    stbl->stsz.total_entries = 0;
+    stbl->stsz.index_base += t->num_samples;
+    }
+
+  if(vtrack && vtrack->picture_numbers)
+    {
+    /* Drop the timestamps, which are no longer needed */
+    keep = vtrack->current_position - REORDER_WINDOW;
+    if(keep > vtrack->timestamps_start)
+      {
+      num = vtrack->current_position + 1 - keep;
+      if(num > vtrack->timestamps_alloc - (keep - vtrack->timestamps_start))
+        num = vtrack->timestamps_alloc - (keep - vtrack->timestamps_start);
+      memmove(vtrack->timestamps,
+              vtrack->timestamps + (keep - vtrack->timestamps_start),
+              num * sizeof(*vtrack->timestamps));
+      vtrack->timestamps_start = keep;
+      }
+
+    /* The picture number of the next frame might be set already */
+    keep = vtrack->cur_chunk;
+    if(keep - vtrack->picture_numbers_start < vtrack->picture_numbers_alloc)
+      vtrack->picture_numbers[0] =
+        vtrack->picture_numbers[keep - vtrack->picture_numbers_start];
+    vtrack->picture_numbers_start = keep;
+    }
+  else if(t->trak->mdia.minf.is_audio && !t->trak->mdia.minf.is_audio_vbr)
+    {
+    /* Constant framesize audio: One stts entry counting the samples */
+    for(i = 0; i < stbl->stts.total_entries; i++)
+      stbl->stts.table[i].sample_count = 0;
+    }
+  else
+    {
+    stbl->stts.total_entries = 0;
+    stbl->stts.num_samples = 0;
+    stbl->stts.index_base += t->num_samples;
+    }
+
+  if(stbl->has_ctts)
+    {
+    stbl->ctts.total_entries = 0;
+    stbl->ctts.num_samples = 0;
+    stbl->ctts.index_base += t->num_samples;
+    }
+
+  stbl->stss.total_entries = 0;
+  }
+
+static void write_traf(quicktime_fragment_t * f, track_t * t,
+                       int64_t moof_start, int traf_number)
+  {
+  buffer_t * b = &f->buf;
+  int64_t traf, trun, pos;
+  uint32_t tfhd_flags, trun_flags;
+  long i, j, run_start, run_samples, sample;
+  int same_duration = 1, same_size = 1, same_flags = 1, negative_cts = 0,
+    has_cts = 0;
+
+  for(i = 0; i < t->num_samples; i++)
+    {
+    if(t->samples[i].duration != t->samples[0].duration)
+      same_duration = 0;
+    if(t->samples[i].size != t->samples[0].size)
+      same_size = 0;
+    if(t->samples[i].flags != t->samples[0].flags)
+      same_flags = 0;
+    if(t->samples[i].cts)
+      has_cts = 1;
+    if(t->samples[i].cts < 0)
+      negative_cts = 1;
+    }
+
+  /* Random access point */
+  if(t->samples[0].flags == SAMPLE_FLAGS_SYNC)
+    {
+    if(t->num_tfra >= t->tfra_alloc)
+      {
+      t->tfra_alloc += 256;
+      t->tfra = realloc(t->tfra, t->tfra_alloc * sizeof(*t->tfra));
+      }
+    t->tfra[t->num_tfra].time = t->dts + t->samples[0].cts;
+    t->tfra[t->num_tfra].moof_offset = moof_start;
+    t->tfra[t->num_tfra].traf_number = traf_number;
+    t->num_tfra++;
+    }
+
+  traf = start_atom(b, "traf");
+
+  /* tfhd */
+  tfhd_flags = TFHD_DEFAULT_BASE_IS_MOOF;
+  if(same_duration)
+    tfhd_flags |= TFHD_DEFAULT_SAMPLE_DURATION;
+  if(same_size)
+    tfhd_flags |= TFHD_DEFAULT_SAMPLE_SIZE;
+  if(same_flags)
+    tfhd_flags |= TFHD_DEFAULT_SAMPLE_FLAGS;
+
+  pos = start_atom(b, "tfhd");
+  put_32(b, tfhd_flags);
+  put_32(b, t->trak->tkhd.track_id);
+  if(same_duration)
+    put_32(b, t->samples[0].duration);
+  if(same_size)
+    put_32(b, t->samples[0].size);
+  if(same_flags)
+    put_32(b, t->samples[0].flags);
+  end_atom(b, pos);
+
+  /* tfdt */
+  pos = start_atom(b, "tfdt");
+  put_32(b, 0x01000000); /* Version 1 */
+  put_64(b, t->dts);
+  end_atom(b, pos);
+
+  /* One trun for each run of adjacent chunks */
+  trun_flags = TRUN_DATA_OFFSET;
+  if(!same_duration)
+    trun_flags |= TRUN_SAMPLE_DURATION;
+  if(!same_size)
+    trun_flags |= TRUN_SAMPLE_SIZE;
+  if(!same_flags)
+    trun_flags |= TRUN_SAMPLE_FLAGS;
+  if(has_cts)
+    trun_flags |= TRUN_SAMPLE_CTS;
+
+  sample = 0;
+  i = 0;
+  while(i < t->num_chunks)
+    {
+    run_start = i;
+    run_samples = t->per_chunk ? 1 : t->chunks[i].samples;
+    i++;
+    while((i < t->num_chunks) &&
+          (t->chunks[i].offset ==
+           t->chunks[i-1].offset + t->chunks[i-1].size))
+      {
+      run_samples += t->per_chunk ? 1 : t->chunks[i].samples;
+      i++;
+      }
+
+    trun = start_atom(b, "trun");
+    put_32(b, (negative_cts ? 0x01000000 : 0) | trun_flags);
+    put_32(b, run_samples);
+
+    /* Offset in the mdat, the start of the mdat is added later */
+    if(f->num_data_offsets >= f->data_offsets_alloc)
+      {
+      f->data_offsets_alloc += 64;
+      f->data_offsets = realloc(f->data_offsets,
+                                f->data_offsets_alloc * sizeof(*f->data_offsets));
+      }
+    f->data_offsets[f->num_data_offsets++] = b->len;
+    put_32(b, t->chunks[run_start].offset);
+
+    for(j = 0; j < run_samples; j++)
+      {
+      if(trun_flags & TRUN_SAMPLE_DURATION)
+        put_32(b, t->samples[sample].duration);
+      if(trun_flags & TRUN_SAMPLE_SIZE)
+        put_32(b, t->samples[sample].size);
+      if(trun_flags & TRUN_SAMPLE_FLAGS)
+        put_32(b, t->samples[sample].flags);
+      if(trun_flags & TRUN_SAMPLE_CTS)
+        put_32(b, t->samples[sample].cts);
+      sample++;
+      }
+    end_atom(b, trun);
+    }
+  end_atom(b, traf);
+
+  for(i = 0; i < t->num_samples; i++)
+    t->dts += t->samples[i].duration;
+  }
+
+/* Write the moov atom with empty sample tables */
+
+static void write_moov(quicktime_t * file)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_trak_t * trak;
+  long * stts_entries;
+  int i;
+
+  stts_entries = malloc(file->moov.total_tracks * sizeof(*stts_entries));
+
+  for(i = 0; i < file->moov.total_tracks; i++)
+    {
+    trak = file->moov.trak[i];
+    stts_entries[i] = trak->mdia.minf.stbl.stts.total_entries;
+    trak->mdia.minf.stbl.stts.total_entries = 0;
+
+    /* Durations are only known in the fragments */
+    trak->has_edts = 0;
+
+    quicktime_iods_add_track(&file->moov.iods, trak);
+    }
+
+  f->moov_start = quicktime_position(file);
+  quicktime_write_moov(file, &file->moov);
+
+  for(i = 0; i < file->moov.total_tracks; i++)
+    file->moov.trak[i]->mdia.minf.stbl.stts.total_entries = stts_entries[i];
+  free(stts_entries);
+  }
+
+void quicktime_fragment_write_mvex(quicktime_t * file)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_atom_t atom, mehd;
+  int i;
+
+  quicktime_atom_write_header(file, &atom, "mvex");
+
+  /* The duration is updated when the file is closed */
+  quicktime_atom_write_header(file, &mehd, "mehd");
+  quicktime_write_char(file, 1);
+  quicktime_write_int24(file, 0);
+  f->mehd_pos = quicktime_position(file);
+  quicktime_write_int64(file, 0);
+  quicktime_atom_write_footer(file, &mehd);
+
+  for(i = 0; i < file->moov.total_tracks; i++)
+    {
+    quicktime_atom_t trex;
+    quicktime_atom_write_header(file, &trex, "trex");
+    quicktime_write_int32(file, 0);
+    quicktime_write_int32(file, file->moov.trak[i]->tkhd.track_id);
+    quicktime_write_int32(file, 1); /* Sample description index */
+    quicktime_write_int32(file, 0); /* Duration */
+    quicktime_write_int32(file, 0); /* Size */
+    quicktime_write_int32(file, 0); /* Flags */
+    quicktime_atom_write_footer(file, &trex);
+    }
+  quicktime_atom_write_footer(file, &atom);
+  }
+
+/* Write a fragment. trigger is the track, for which the next
+   picture was already passed to lqt_video_append_timestamp() */
+
+static void write_fragment(quicktime_t * file, quicktime_trak_t * trigger)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  int i, traf_number, have_samples = 0, mdat_header;
+  int64_t moof, pos, moof_start;
+  track_t * t;
+
+  get_track(file, NULL);
+
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    t = &f->tracks[i];
+    if(t->num_chunks)
+      {
+      get_samples(file, t, t->trak == trigger);
+      clear_samples(file, t);
+      have_samples = 1;
+      }
+    else
+      t->num_samples = 0;
+    }
+
+  if(!have_samples && f->moov_start)
+    return;
+
+  if(!f->moov_start)
+    write_moov(file);
+
+  if(have_samples)
+    {
+    f->sequence_number++;
+    f->buf.len = 0;
+    f->num_data_offsets = 0;
+    moof_start = quicktime_position(file);
+
+    moof = start_atom(&f->buf, "moof");
+    pos = start_atom(&f->buf, "mfhd");
+    put_32(&f->buf, 0);
+    put_32(&f->buf, f->sequence_number);
+    end_atom(&f->buf, pos);
+
+    traf_number = 1;
+    for(i = 0; i < f->num_tracks; i++)
+      {
+      t = &f->tracks[i];
+      if(t->num_samples)
+        write_traf(f, t, moof_start, traf_number++);
+      t->num_chunks = 0;
+      }
+    end_atom(&f->buf, moof);
+
+    /* The media data follow the moof atom */
+    mdat_header = (f->mdat.len + 8 > 0xffffffffLL) ? 16 : 8;
+    for(i = 0; i < f->num_data_offsets; i++)
+      set_32(&f->buf, f->data_offsets[i],
+             get_32(&f->buf, f->data_offsets[i]) + f->buf.len + mdat_header);
+
+    if(mdat_header == 16)
+      {
+      put_32(&f->buf, 1);
+      put_fourcc(&f->buf, "mdat");
+      put_64(&f->buf, f->mdat.len + 16);
+      }
+    else
+      {
+      put_32(&f->buf, f->mdat.len + 8);
+      put_fourcc(&f->buf, "mdat");
+      }
+    quicktime_write_data(file, f->buf.data, f->buf.len);
+    quicktime_write_data(file, f->mdat.data, f->mdat.len);
+    f->mdat.len = 0;
+    }
+  }
+
+void quicktime_fragment_check(quicktime_t * file, quicktime_trak_t * trak)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_video_map_t * vtrack;
+  int64_t time;
+  int timescale;
+  track_t * t;
+
+  /* Fragments start at keyframes of the first video track or
+     with chunks of the first audio track */
+  if(file->total_vtracks)
+    {
+    vtrack = &file->vtracks[0];
+    if(trak != vtrack->track)
+      return;
+
+    t = get_track(file, trak);
+    if(!vtrack->keyframe &&
+       (trak->mdia.minf.stbl.stss.total_entries || t->has_keyframes))
+      return;
+
+    if(vtrack->picture_numbers)
+      time = picture_time(vtrack, vtrack->current_position);
+    else
+      time = vtrack->timestamp;
+    }
+  else if(file->total_atracks)
+    {
+    if(trak != file->atracks[0].track)
+      return;
+    time = file->atracks[0].current_position;
+    }
+  else
+    return;
+
+  timescale = trak->mdia.mdhd.time_scale;
+
+  if(!f->started)
+    {
+    f->start_time = time;
+    f->started = 1;
+    return;
+    }
+
+  if(((f->seconds > 0.0) &&
+      (time - f->start_time >= f->seconds * timescale)) ||
+     ((f->bytes > 0) &&
+      (f->mdat.len >= f->bytes)))
+    {
+    write_fragment(file, trak);
+    f->start_time = time;
+    }
+  }
+
+static void write_mfra(quicktime_t * file)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  buffer_t * b = &f->buf;
+  int64_t mfra, pos;
+  track_t * t;
+  int i, j;
+
+  b->len = 0;
+  mfra = start_atom(b, "mfra");
+
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    t = &f->tracks[i];
+    if(!t->num_tfra)
+      continue;
+
+    pos = start_atom(b, "tfra");
+    put_32(b, 0x01000000); /* Version 1 */
+    put_32(b, t->trak->tkhd.track_id);
+    put_32(b, 0x3f); /* 32 bit traf, trun and sample numbers */
+    put_32(b, t->num_tfra);
+    for(j = 0; j < t->num_tfra; j++)
+      {
+      put_64(b, t->tfra[j].time);
+      put_64(b, t->tfra[j].moof_offset);
+      put_32(b, t->tfra[j].traf_number);
+      put_32(b, 1); /* trun */
+      put_32(b, 1); /* sample */
+      }
+    end_atom(b, pos);
+    }
+
+  pos = start_atom(b, "mfro");
+  put_32(b, 0);
+  put_32(b, b->len - mfra + 4);
+  end_atom(b, pos);
+  end_atom(b, mfra);
+
+  quicktime_write_data(file, b->data, b->len);
+  }
+
+int quicktime_fragment_close(quicktime_t * file)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  int64_t duration = 0, track_duration, end;
+  int i;
+  track_t * t;
+
+  write_fragment(file, NULL);
+  write_mfra(file);
+
+  /* Update the duration in the mehd atom */
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    t = &f->tracks[i];
+    if(!t->trak->mdia.mdhd.time_scale)
+      continue;
+    track_duration = (double)(t->dts - t->start_dts) /
+      t->trak->mdia.mdhd.time_scale * file->moov.mvhd.time_scale + 0.5;
+    if(track_duration > duration)
+      duration = track_duration;
+    }
+
+  end = quicktime_position(file);
+  quicktime_set_position(file, f->mehd_pos);
+  quicktime_write_int64(file, duration);
+  quicktime_set_position(file, end);
+
+  return !!file->io_error;
+  }
+
+/*
+ *  Reading
+ */
+
+void quicktime_fragment_read_mvex(quicktime_t * file,
+                                  quicktime_atom_t * parent_atom)
+  {
+  quicktime_fragment_t * f;
+  quicktime_atom_t leaf_atom;
+  trex_t * trex;
+
+  if(!file->fragment)
+    file->fragment = calloc(1, sizeof(*file->fragment));
+  f = file->fragment;
+
+  do
+    {
+    if(quicktime_atom_read_header(file, &leaf_atom))
+      break;
+
+    if(quicktime_atom_is(&leaf_atom, "trex"))
+      {
+      f->trex = realloc(f->trex, (f->num_trex + 1) * sizeof(*f->trex));
+      trex = &f->trex[f->num_trex++];
+      quicktime_read_int32(file); /* Version and flags */
+      trex->track_id                 = quicktime_read_int32(file);
+      trex->sample_description_index = quicktime_read_int32(file);
+      trex->duration                 = quicktime_read_int32(file);
+      trex->size                     = quicktime_read_int32(file);
+      trex->flags                    = quicktime_read_int32(file);
+      }
+    quicktime_atom_skip(file, &leaf_atom);
+    }while(quicktime_position(file) < parent_atom->end);
+  }
+
+static quicktime_trak_t * find_trak(quicktime_t * file, uint32_t track_id)
+  {
+  int i;
+  for(i = 0; i < file->moov.total_tracks; i++)
+    {
+    if(file->moov.trak[i]->tkhd.track_id == track_id)
+      return file->moov.trak[i];
+    }
+  return NULL;
+  }
+
+/* Defaults for a track, tracks without trex get the ones of no_trex */
+
+static const trex_t * find_trex(quicktime_fragment_t * f, uint32_t track_id)
+  {
+  static const trex_t no_trex = { 0, 1, 0, 0, 0 };
+  int i;
+  for(i = 0; i < f->num_trex; i++)
+    {
+    if(f->trex[i].track_id == track_id)
+      return &f->trex[i];
+    }
+  return &no_trex;
+  }
+
+/* Read the header of the atom at offset */
+
+static int read_atom_at(quicktime_t * file, int64_t offset,
+                        quicktime_atom_t * atom)
+  {
+  if((offset < 0) || (offset + 8 > file->total_length))
+    return 0;
+  quicktime_set_position(file, offset);
+  if(quicktime_atom_read_header(file, atom) ||
+     (atom->end <= atom->start) || (atom->end > file->total_length))
+    return 0;
+  return 1;
+  }
+
+/* Load the rest of a small atom into the preload buffer, like it's
+   done for the moov atom */
+
+static void preload_atom(quicktime_t * file, quicktime_atom_t * atom)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  int64_t pos = quicktime_position(file);
+  int64_t len = atom->end - pos;
+
+  if(file->mmap_buffer || (len > file->preload_size) || (len <= 0))
+    return;
+
+  f->buf.len = 0;
+  buffer_alloc(&f->buf, len);
+  quicktime_read_data(file, f->buf.data, len);
+  quicktime_set_position(file, pos);
+  }
+
+/* Initialize a track for appending samples */
+
+static track_t * get_read_track(quicktime_t * file, quicktime_trak_t * trak)
+  {
+  track_t * t = get_track(file, trak);
+  quicktime_stbl_t * stbl = &trak->mdia.minf.stbl;
+  int i;
+
+  if(t->read_init)
+    return t;
+
+  /* Samples in the moov atom */
+  for(i = 0; i < stbl->stts.total_entries; i++)
+    t->total_samples += stbl->stts.table[i].sample_count;
+  t->has_non_sync = !!stbl->stss.total_entries;
+
+  /* Chunk sizes are exact for fragments. Get the others before
+     the fragments are appended */
+  if(stbl->stco.total_entries && !trak->chunk_sizes)
+    {
+    trak->chunk_sizes = lqt_get_chunk_sizes(file, trak);
+    trak->chunk_sizes_alloc = stbl->stco.total_entries;
+    }
+  t->read_init = 1;
+  return t;
+  }
+
+static void append_chunk(quicktime_trak_t * trak, int64_t offset,
+                         int64_t size, long samples, long id)
+  {
+  quicktime_stbl_t * stbl = &trak->mdia.minf.stbl;
+  quicktime_stsc_t * stsc = &stbl->stsc;
+  long chunk = stbl->stco.total_entries;
+  int old_alloc;
+
+  quicktime_update_stco(&stbl->stco, chunk, offset);
+
+  if(!stsc->total_entries ||
+     (stsc->table[stsc->total_entries-1].samples != samples) ||
+     (stsc->table[stsc->total_entries-1].id != id))
+    {
+    if(stsc->total_entries >= stsc->entries_allocated)
+      {
+      stsc->entries_allocated = stsc->total_entries * 2 + 256;
+      stsc->table = realloc(stsc->table,
+                            stsc->entries_allocated * sizeof(*stsc->table));
+      }
+    stsc->table[stsc->total_entries].chunk = chunk + 1;
+    stsc->table[stsc->total_entries].samples = samples;
+    stsc->table[stsc->total_entries].id = id;
+    stsc->total_entries++;
+    }
+
+  if(chunk >= trak->chunk_sizes_alloc)
+    {
+    old_alloc = trak->chunk_sizes_alloc;
+    trak->chunk_sizes_alloc = chunk * 2 + 256;
+    trak->chunk_sizes = realloc(trak->chunk_sizes,
+                                trak->chunk_sizes_alloc *
+                                sizeof(*trak->chunk_sizes));
+    memset(trak->chunk_sizes + old_alloc, 0,
+           (trak->chunk_sizes_alloc - old_alloc) * sizeof(*trak->chunk_sizes));
+    }
+  trak->chunk_sizes[chunk] = size;
+  }
+
+static void append_stss(quicktime_stss_t * stss, long sample)
+  {
+  if(stss->total_entries >= stss->entries_allocated)
+    {
+    stss->entries_allocated = stss->total_entries * 2 + 256;
+    stss->table = realloc(stss->table,
+                          stss->entries_allocated * sizeof(*stss->table));
+    }
+  stss->table[stss->total_entries++].sample = sample;
+  }
+
+/* Append count samples with the same properties */
+
+static void append_sample(quicktime_trak_t * trak, track_t * t,
+                          uint32_t size, uint32_t duration,
+                          int32_t cts, uint32_t flags, long count)
+  {
+  quicktime_stbl_t * stbl = &trak->mdia.minf.stbl;
+  quicktime_stsz_t * stsz = &stbl->stsz;
+  quicktime_stts_t * stts = &stbl->stts;
+  quicktime_ctts_t * ctts = &stbl->ctts;
+  long i;
+
+  /* stsz */
+  if(stsz->sample_size)
+    {
+    /* Constant framesize audio has no meaningful sample sizes */
+    if((size == stsz->sample_size) ||
+       (trak->mdia.minf.is_audio && !trak->mdia.minf.is_audio_vbr))
+      stsz->total_entries += count;
+    else
+      {
+      stsz->entries_allocated = stsz->total_entries * 2 + 256;
+      stsz->table = realloc(stsz->table,
+                            stsz->entries_allocated * sizeof(*stsz->table));
+      for(i = 0; i < stsz->total_entries; i++)
+        stsz->table[i].size = stsz->sample_size;
+      stsz->sample_size = 0;
+      }
+    }
+  if(!stsz->sample_size)
+    {
+    if(stsz->total_entries + count > stsz->entries_allocated)
+      {
+      stsz->entries_allocated = (stsz->total_entries + count) * 2 + 256;
+      stsz->table = realloc(stsz->table,
+                            stsz->entries_allocated * sizeof(*stsz->table));
+      }
+    for(i = 0; i < count; i++)
+      stsz->table[stsz->total_entries++].size = size;
+    }
+
+  /* stts */
+  if(!stts->total_entries ||
+     (stts->table[stts->total_entries-1].sample_duration != duration))
+    {
+    if(stts->total_entries >= stts->entries_allocated)
+      {
+      stts->entries_allocated = stts->total_entries * 2 + 256;
+      stts->table = realloc(stts->table,
+                            stts->entries_allocated * sizeof(*stts->table));
+      }
+    stts->table[stts->total_entries].sample_count = 0;
+    stts->table[stts->total_entries].sample_duration = duration;
+    stts->total_entries++;
+    }
+  stts->table[stts->total_entries-1].sample_count += count;
+
+  /* ctts: Add an entry for the previous samples if it's the
+     first nonzero composition offset */
+  if(cts && !stbl->has_ctts)
+    {
+    stbl->has_ctts = 1;
+    ctts->total_entries = 0;
+    if(t->total_samples)
+      {
+      ctts->entries_allocated = 256;
+      ctts->table = realloc(ctts->table,
+                            ctts->entries_allocated * sizeof(*ctts->table));
+      ctts->table[0].sample_count = t->total_samples;
+      ctts->table[0].sample_duration = 0;
+      ctts->total_entries = 1;
+      }
+    }
+  if(stbl->has_ctts)
+    {
+    if(!ctts->total_entries ||
+       (ctts->table[ctts->total_entries-1].sample_duration != cts))
+      {
+      if(ctts->total_entries >= ctts->entries_allocated)
+        {
+        ctts->entries_allocated = ctts->total_entries * 2 + 256;
+        ctts->table = realloc(ctts->table,
+                              ctts->entries_allocated * sizeof(*ctts->table));
+        }
+      ctts->table[ctts->total_entries].sample_count = 0;
+      ctts->table[ctts->total_entries].sample_duration = cts;
+      ctts->total_entries++;
+      }
+    ctts->table[ctts->total_entries-1].sample_count += count;
+    }
+
+  /* stss: An empty table means, that all samples are sync samples */
+  if(flags & SAMPLE_FLAGS_NON_SYNC_BIT)
+    {
+    if(!t->has_non_sync)
+      {
+      for(i = 0; i < t->total_samples; i++)
+        append_stss(&stbl->stss, i + 1);
+      t->has_non_sync = 1;
+      }
+    }
+  else if(t->has_non_sync)
+    {
+    for(i = 0; i < count; i++)
+      append_stss(&stbl->stss, t->total_samples + i + 1);
+    }
+
+  t->total_samples += count;
+  t->dts += (int64_t)duration * count;
+  }
+
+static void read_trun(quicktime_t * file, quicktime_trak_t * trak,
+                      track_t * t, const trex_t * defaults,
+                      int64_t base_offset, int64_t * data_pos)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  uint32_t flags, first_flags = 0, size, duration, sample_flags;
+  int32_t cts;
+  int64_t offset, total_size = 0;
+  long count, i, samples = 0;
+  int per_chunk;
+
+  /* Constant framesize audio: A sample of the fragment stands for
+     as many samples in our tables as its duration says */
+  per_chunk = trak->mdia.minf.is_audio && !trak->mdia.minf.is_audio_vbr;
+
+  flags = quicktime_read_int32(file) & 0xffffff;
+  count = quicktime_read_int32(file);
+
+  if(flags & TRUN_DATA_OFFSET)
+    *data_pos = base_offset + (int32_t)quicktime_read_int32(file);
+  if(flags & TRUN_FIRST_SAMPLE_FLAGS)
+    first_flags = quicktime_read_int32(file);
+
+  offset = *data_pos;
+
+  for(i = 0; i < count; i++)
+    {
+    duration = (flags & TRUN_SAMPLE_DURATION) ?
+      quicktime_read_int32(file) : defaults->duration;
+    size = (flags & TRUN_SAMPLE_SIZE) ?
+      quicktime_read_int32(file) : defaults->size;
+
+    if(flags & TRUN_SAMPLE_FLAGS)
+      sample_flags = quicktime_read_int32(file);
+    else if(!i && (flags & TRUN_FIRST_SAMPLE_FLAGS))
+      sample_flags = first_flags;
+    else
+      sample_flags = defaults->flags;
+
+    /* Version 0 offsets are unsigned, but never that large */
+    cts = (flags & TRUN_SAMPLE_CTS) ? (int32_t)quicktime_read_int32(file) : 0;
+
+    /* Incomplete file */
+    if(offset + total_size + size > file->total_length)
+      {
+      lqt_log(file, LQT_LOG_WARNING, LOG_DOMAIN,
+              "Fragment data truncated, dropping the remaining samples");
+      f->truncated = 1;
+      break;
+      }
+
+    if(per_chunk && duration)
+      {
+      append_sample(trak, t, size, 1, cts, sample_flags, duration);
+      samples += duration;
+      }
+    else
+      {
+      append_sample(trak, t, size, duration, cts, sample_flags, 1);
+      samples++;
+      }
+    total_size += size;
+    }
+
+  if(samples)
+    append_chunk(trak, offset, total_size, samples,
+                 defaults->sample_description_index);
+  *data_pos = offset + total_size;
+  }
+
+static void read_traf(quicktime_t * file, quicktime_atom_t * parent_atom,
+                      int64_t moof_start, int64_t * data_end)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_atom_t leaf_atom;
+  quicktime_trak_t * trak = NULL;
+  track_t * t = NULL;
+  trex_t defaults = { 0, 1, 0, 0, 0 };
+  uint32_t flags, track_id;
+  int64_t base_offset = 0, data_pos = *data_end;
+  int version;
+
+  do
+    {
+    if(quicktime_atom_read_header(file, &leaf_atom))
+      break;
+
+    if(quicktime_atom_is(&leaf_atom, "tfhd"))
+      {
+      flags = quicktime_read_int32(file) & 0xffffff;
+      track_id = quicktime_read_int32(file);
+      defaults = *find_trex(f, track_id);
+
+      if(!(trak = find_trak(file, track_id)))
+        {
+        lqt_log(file, LQT_LOG_WARNING, LOG_DOMAIN,
+                "Fragment for unknown track %d", track_id);
+        break;
+        }
+      t = get_read_track(file, trak);
+
+      if(flags & TFHD_BASE_DATA_OFFSET)
+        base_offset = quicktime_read_int64(file);
+      else if(flags & TFHD_DEFAULT_BASE_IS_MOOF)
+        base_offset = moof_start;
+      else
+        base_offset = *data_end;
+
+      if(flags & TFHD_SAMPLE_DESCRIPTION_INDEX)
+        defaults.sample_description_index = quicktime_read_int32(file);
+      if(flags & TFHD_DEFAULT_SAMPLE_DURATION)
+        defaults.duration = quicktime_read_int32(file);
+      if(flags & TFHD_DEFAULT_SAMPLE_SIZE)
+        defaults.size = quicktime_read_int32(file);
+      if(flags & TFHD_DEFAULT_SAMPLE_FLAGS)
+        defaults.flags = quicktime_read_int32(file);
+      data_pos = base_offset;
+      }
+    else if(quicktime_atom_is(&leaf_atom, "tfdt") && t)
+      {
+      version = quicktime_read_char(file);
+      quicktime_read_int24(file);
+      t->dts = version ? quicktime_read_int64(file) : quicktime_read_int32(file);
+      }
+    else if(quicktime_atom_is(&leaf_atom, "trun") && t && !f->truncated)
+      read_trun(file, trak, t, &defaults, base_offset, &data_pos);
+
+    quicktime_atom_skip(file, &leaf_atom);
+    }while(quicktime_position(file) < parent_atom->end);
+
+  if(t)
+    t->dts_valid = 1;
+  *data_end = data_pos;
+  quicktime_set_position(file, parent_atom->end);
+  }
+
+static void read_moof(quicktime_t * file, quicktime_atom_t * moof)
+  {
+  quicktime_atom_t leaf_atom;
+  int64_t data_end = moof->start;
+
+  preload_atom(file, moof);
+
+  while(!file->fragment->truncated &&
+        (quicktime_position(file) + 8 <= moof->end))
+    {
+    if(quicktime_atom_read_header(file, &leaf_atom))
+      break;
+    if(quicktime_atom_is(&leaf_atom, "traf"))
+      read_traf(file, &leaf_atom, moof->start, &data_end);
+    quicktime_atom_skip(file, &leaf_atom);
+    }
+  quicktime_set_position(file, moof->end);
+  }
+
+/* Read the moof atoms between start and end */
+
+static void walk(quicktime_t * file, int64_t start, int64_t end)
+  {
+  quicktime_atom_t atom;
+
+  while(!file->fragment->truncated &&
+        (start < end) && read_atom_at(file, start, &atom))
+    {
+    if(quicktime_atom_is(&atom, "moof"))
+      read_moof(file, &atom);
+    start = atom.end;
+    }
+  }
+
+/* Check if the moof at offset directly follows the fragments
+   read so far. This is the case if all tracks continue with the
+   expected decode time. */
+
+static int check_moof(quicktime_t * file, int64_t offset)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_atom_t moof, traf, leaf_atom;
+  quicktime_trak_t * trak;
+  track_t * t = NULL;
+  int i, tracks = 0, found = 0, version;
+  int64_t time;
+
+  if(!read_atom_at(file, offset, &moof) || !quicktime_atom_is(&moof, "moof"))
+    return 0;
+  preload_atom(file, &moof);
+
+  for(i = 0; i < f->num_tracks; i++)
+    {
+    if(f->tracks[i].dts_valid)
+      tracks++;
+    }
+
+  while(quicktime_position(file) + 8 <= moof.end)
+    {
+    if(quicktime_atom_read_header(file, &traf))
+      return 0;
+
+    if(quicktime_atom_is(&traf, "traf"))
+      {
+      t = NULL;
+      while(quicktime_position(file) + 8 <= traf.end)
+        {
+        if(quicktime_atom_read_header(file, &leaf_atom))
+          return 0;
+        if(quicktime_atom_is(&leaf_atom, "tfhd"))
+          {
+          quicktime_read_int32(file);
+          if(!(trak = find_trak(file, quicktime_read_int32(file))))
+            return 0;
+          t = get_track(file, trak);
+          if(!t->dts_valid)
+            return 0;
+          }
+        else if(quicktime_atom_is(&leaf_atom, "tfdt") && t)
+          {
+          version = quicktime_read_char(file);
+          quicktime_read_int24(file);
+          time = version ? quicktime_read_int64(file) :
+            quicktime_read_int32(file);
+          if(time != t->dts)
+            return 0;
+          found++;
+          break;
+          }
+        quicktime_atom_skip(file, &leaf_atom);
+        }
+      }
+    quicktime_atom_skip(file, &traf);
+    }
+  return found == tracks;
+  }
+
+static void add_moof(quicktime_fragment_t * f, int64_t offset)
+  {
+  if(f->num_moofs >= f->moofs_alloc)
+    {
+    f->moofs_alloc = f->num_moofs * 2 + 256;
+    f->moofs = realloc(f->moofs, f->moofs_alloc * sizeof(*f->moofs));
+    }
+  f->moofs[f->num_moofs++] = offset;
+  }
+
+static int compare_offsets(const void * p1, const void * p2)
+  {
+  const int64_t * o1 = p1;
+  const int64_t * o2 = p2;
+  return (*o1 > *o2) - (*o1 < *o2);
+  }
+
+/* Each reference of a sidx atom points to a subsegment (starting
+   with a moof atom) or to another sidx atom */
+
+static void read_sidx(quicktime_t * file, quicktime_atom_t * atom, int depth)
+  {
+  quicktime_atom_t child;
+  int64_t anchor, pos;
+  uint32_t reference;
+  int version, count, i;
+
+  version = quicktime_read_char(file);
+  quicktime_read_int24(file);
+  quicktime_read_int32(file); /* Reference ID */
+  quicktime_read_int32(file); /* Timescale */
+  if(version)
+    {
+    quicktime_read_int64(file); /* Earliest presentation time */
+    anchor = atom->end + quicktime_read_int64(file);
+    }
+  else
+    {
+    quicktime_read_int32(file);
+    anchor = atom->end + quicktime_read_int32(file);
+    }
+  quicktime_read_int16(file); /* Reserved */
+  count = quicktime_read_int16(file);
+
+  for(i = 0; i < count; i++)
+    {
+    reference = quicktime_read_int32(file);
+    quicktime_read_int32(file); /* Duration */
+    quicktime_read_int32(file); /* SAP */
+
+    if(!(reference & 0x80000000))
+      add_moof(file->fragment, anchor);
+    else if(depth < MAX_SIDX_DEPTH)
+      {
+      pos = quicktime_position(file);
+      if(read_atom_at(file, anchor, &child) &&
+         quicktime_atom_is(&child, "sidx"))
+        read_sidx(file, &child, depth + 1);
+      quicktime_set_position(file, pos);
+      }
+    anchor += reference & 0x7fffffff;
+    }
+  }
+
+/* Get the moof positions from the tfra atoms. The mfro atom at the
+   end of the file tells us, where the mfra atom starts */
+
+static void read_mfra(quicktime_t * file)
+  {
+  quicktime_atom_t atom, leaf_atom;
+  uint32_t sizes;
+  uint8_t skip[12];
+  int version, skip_len;
+  long count, i;
+
+  if(!read_atom_at(file, file->total_length - 16, &atom) ||
+     !quicktime_atom_is(&atom, "mfro"))
+    return;
+  quicktime_read_int32(file);
+
+  if(!read_atom_at(file, file->total_length - quicktime_read_int32(file),
+                   &atom) ||
+     !quicktime_atom_is(&atom, "mfra"))
+    return;
+
+  preload_atom(file, &atom);
+
+  while(quicktime_position(file) + 8 <= atom.end)
+    {
+    if(quicktime_atom_read_header(file, &leaf_atom))
+      break;
+    if(quicktime_atom_is(&leaf_atom, "tfra"))
+      {
+      version = quicktime_read_char(file);
+      quicktime_read_int24(file);
+      quicktime_read_int32(file); /* Track ID */
+      sizes = quicktime_read_int32(file);
+      count = quicktime_read_int32(file);
+
+      /* traf, trun and sample number */
+      skip_len = ((sizes >> 4) & 3) + ((sizes >> 2) & 3) + (sizes & 3) + 3;
+
+      for(i = 0; i < count; i++)
+        {
+        if(version)
+          {
+          quicktime_read_int64(file);
+          add_moof(file->fragment, quicktime_read_int64(file));
+          }
+        else
+          {
+          quicktime_read_int32(file);
+          add_moof(file->fragment, quicktime_read_int32(file));
+          }
+        quicktime_read_data(file, skip, skip_len);
+        }
+      }
+    quicktime_atom_skip(file, &leaf_atom);
+    }
+  }
+
+/* Called by quicktime_read_info() for top level sidx and moof atoms
+   after the moov atom. Return 1 if all fragments were read (or the
+   rest is truncated), 0 if the caller should continue with the
+   next atom. */
+
+int quicktime_fragment_read(quicktime_t * file, quicktime_atom_t * atom)
+  {
+  quicktime_fragment_t * f = file->fragment;
+  quicktime_atom_t moof;
+  int64_t pos;
+  int i;
+
+  if(quicktime_atom_is(atom, "sidx"))
+    {
+    if(!f->indexed)
+      read_sidx(file, atom, 0);
+    quicktime_set_position(file, atom->end);
+    return 0;
+    }
+
+  /* moof */
+  if(!f->indexed)
+    {
+    f->indexed = 1;
+    if(!f->num_moofs)
+      {
+      pos = quicktime_position(file);
+      read_mfra(file);
+      quicktime_set_position(file, pos);
+      }
+    }
+
+  if(!f->num_moofs)
+    {
+    /* No index: Continue walking */
+    read_moof(file, atom);
+    if(f->truncated)
+      {
+      quicktime_set_position(file, file->total_length);
+      return 1;
+      }
+    return 0;
+    }
+
+  qsort(f->moofs, f->num_moofs, sizeof(*f->moofs), compare_offsets);
+
+  pos = atom->start;
+  for(i = 0; (i < f->num_moofs) && !f->truncated; i++)
+    {
+    if(f->moofs[i] < pos)
+      continue;
+    if((f->moofs[i] > pos) && !check_moof(file, f->moofs[i]))
+      walk(file, pos, f->moofs[i]);
+
+    if(!read_atom_at(file, f->moofs[i], &moof) ||
+       !quicktime_atom_is(&moof, "moof"))
+      continue;
+    read_moof(file, &moof);
+    pos = moof.end;
+    }
+
+  /* Fragments after the last indexed one */
+  walk(file, pos, file->total_length);
+  quicktime_set_position(file, file->total_length);
+  return 1;
+  }
+
+/* Update the durations after all fragments are read */
+
+void quicktime_fragment_finish_read(quicktime_t * file)
+  {
+  quicktime_trak_t * trak;
+  int64_t duration;
+  int i, timescale;
+
+  /* Built with the chunks from the moov atom only */
+  if(file->chunk_map)
+    {
+    free(file->chunk_map);
+    file->chunk_map = NULL;
+    file->chunk_map_size = 0;
+    file->chunk_map_pos = 0;
+    }
+
+  for(i = 0; i < file->moov.total_tracks; i++)
+    {
+    trak = file->moov.trak[i];
+    quicktime_trak_duration(trak, &duration, &timescale);
+    if(!timescale || (duration <= trak->mdia.mdhd.duration))
+      continue;
+    trak->mdia.mdhd.duration = duration;
+    trak->tkhd.duration = (double)duration / timescale *
+      file->moov.mvhd.time_scale + 0.5;
+    if(trak->tkhd.duration > file->moov.mvhd.duration)
+      file->moov.mvhd.duration = trak->tkhd.duration;
+    }
+  }
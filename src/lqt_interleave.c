@@ -0,0 +1,265 @@
+/*******************************************************************************
+ lqt_interleave.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Interleaving of chunks.
+ *
+ *  Without this, each call of quicktime_write_chunk_header() starts a new
+ *  chunk in the file, so the interleaving depends on the order in which
+ *  the application encodes the tracks.
+ *
+ *  Here, the data written between quicktime_write_chunk_header() and
+ *  quicktime_write_chunk_footer() are appended to a buffer of the track.
+ *  quicktime_position() returns positions inside this buffer, so the
+ *  sizes of samples and chunks are calculated as usual. All sample tables
+ *  except stco and stsc are filled by the usual functions. When all audio
+ *  and video tracks have advanced by the interleave duration, the buffers
+ *  are written as one chunk per track and the chunks are added to stco
+ *  and stsc.
+ */
+
+#include "lqt_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* All buffers are written if they grow larger than this (e.g. if one track
+   has no more data) */
+#define MAX_BYTES (32*1024*1024)
+
+typedef struct
+  {
+  quicktime_trak_t * trak;
+
+  uint8_t * buf;
+  int64_t len;
+  int64_t alloc;
+
+  /* Samples in buf */
+  long samples;
+  } track_t;
+
+struct quicktime_interleave_s
+  {
+  double seconds;
+
+  track_t * tracks;
+  int num_tracks;
+
+  /* Track of the open chunk */
+  track_t * cur;
+
+  /* Bytes in all buffers */
+  int64_t size;
+
+  /* Time up to which the buffers were written */
+  double flushed;
+  };
+
+int lqt_set_interleave(quicktime_t * file, int ms)
+  {
+  if(!file->wr ||
+     (file->file_type & (LQT_FILE_AVI|LQT_FILE_AVI_ODML)) ||
+     file->fragment)
+    return 1;
+
+  if(ms <= 0)
+    {
+    if(file->interleave)
+      {
+      if(file->write_trak)
+        quicktime_write_chunk_footer(file, file->write_trak);
+      quicktime_interleave_flush(file);
+      quicktime_interleave_delete(file);
+      }
+    return 0;
+    }
+
+  if(!file->interleave)
+    {
+    /* The open chunk goes into the file */
+    if(file->write_trak)
+      quicktime_write_chunk_footer(file, file->write_trak);
+    file->interleave = calloc(1, sizeof(*file->interleave));
+    }
+  file->interleave->seconds = (double)ms / 1000.0;
+  return 0;
+  }
+
+void quicktime_interleave_delete(quicktime_t * file)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  int i;
+
+  for(i = 0; i < ilv->num_tracks; i++)
+    {
+    if(ilv->tracks[i].buf)
+      free(ilv->tracks[i].buf);
+    }
+  if(ilv->tracks)
+    free(ilv->tracks);
+  free(ilv);
+  file->interleave = NULL;
+  }
+
+static track_t * get_track(quicktime_t * file, quicktime_trak_t * trak)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  int i;
+
+  if(ilv->num_tracks < file->moov.total_tracks)
+    {
+    ilv->tracks = realloc(ilv->tracks,
+                          file->moov.total_tracks * sizeof(*ilv->tracks));
+    memset(ilv->tracks + ilv->num_tracks, 0,
+           (file->moov.total_tracks - ilv->num_tracks) * sizeof(*ilv->tracks));
+
+    for(i = ilv->num_tracks; i < file->moov.total_tracks; i++)
+      ilv->tracks[i].trak = file->moov.trak[i];
+    ilv->num_tracks = file->moov.total_tracks;
+    }
+
+  for(i = 0; i < ilv->num_tracks; i++)
+    {
+    if(ilv->tracks[i].trak == trak)
+      return &ilv->tracks[i];
+    }
+  return NULL;
+  }
+
+/* Time in seconds up to which a track was written */
+
+static double track_time(quicktime_t * file, track_t * t)
+  {
+  int64_t duration;
+  int timescale;
+  int i;
+
+  quicktime_trak_duration(t->trak, &duration, &timescale);
+
+  /* The stts of encoded video tracks is built when the file is closed */
+  for(i = 0; i < file->total_vtracks; i++)
+    {
+    if((file->vtracks[i].track == t->trak) && file->vtracks[i].timestamps)
+      duration = file->vtracks[i].duration;
+    }
+
+  if(timescale <= 0)
+    return 0.0;
+  return (double)duration / (double)timescale;
+  }
+
+int64_t quicktime_interleave_start(quicktime_t * file, quicktime_trak_t * trak)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  ilv->cur = get_track(file, trak);
+  return ilv->cur->len;
+  }
+
+int quicktime_interleave_write(quicktime_t * file, const uint8_t * data, int size)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  track_t * t = ilv->cur;
+
+  if(!t)
+    return 0;
+
+  if(t->len + size > t->alloc)
+    {
+    t->alloc = (t->len + size) * 2 + 65536;
+    t->buf = realloc(t->buf, t->alloc);
+    }
+  memcpy(t->buf + t->len, data, size);
+  t->len += size;
+  ilv->size += size;
+  return 1;
+  }
+
+int64_t quicktime_interleave_position(quicktime_t * file)
+  {
+  if(!file->interleave->cur)
+    return -1;
+  return file->interleave->cur->len;
+  }
+
+void quicktime_interleave_add_chunk(quicktime_t * file, long samples)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  double t, min_time = -1.0;
+  int i;
+
+  ilv->cur->samples += samples;
+  ilv->cur = NULL;
+
+  if(ilv->size < MAX_BYTES)
+    {
+    /* Wait until all audio and video tracks are ahead */
+    for(i = 0; i < ilv->num_tracks; i++)
+      {
+      if(!ilv->tracks[i].trak->mdia.minf.is_audio &&
+         !ilv->tracks[i].trak->mdia.minf.is_video)
+        continue;
+      t = track_time(file, &ilv->tracks[i]);
+      if((min_time < 0.0) || (t < min_time))
+        min_time = t;
+      }
+    if(min_time < ilv->flushed + ilv->seconds)
+      return;
+    ilv->flushed = min_time;
+    }
+
+  quicktime_interleave_flush(file);
+  }
+
+/* Write all buffers, one chunk per track */
+
+void quicktime_interleave_flush(quicktime_t * file)
+  {
+  quicktime_interleave_t * ilv = file->interleave;
+  quicktime_stco_t * stco;
+  track_t * t;
+  int64_t offset;
+  int i;
+
+  for(i = 0; i < ilv->num_tracks; i++)
+    {
+    t = &ilv->tracks[i];
+    if(!t->len)
+      continue;
+
+    offset = quicktime_position(file);
+    quicktime_write_data(file, t->buf, (int)t->len);
+
+    stco = &t->trak->mdia.minf.stbl.stco;
+    quicktime_update_stco(stco, stco->total_entries, offset);
+    quicktime_update_stsc(&t->trak->mdia.minf.stbl.stsc,
+                          stco->total_entries - 1, t->samples);
+
+    if(offset + t->len > file->mdat.atom.size)
+      file->mdat.atom.size = offset + t->len;
+
+    t->len = 0;
+    t->samples = 0;
+    }
+  ilv->size = 0;
+  }
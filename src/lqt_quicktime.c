@@ -30,6 +30,13 @@
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #define LQT_LIBQUICKTIME
 #include <quicktime/lqt_codecapi.h>
 
@@ -50,19 +57,295 @@ int lqt_fileno(quicktime_t *file)
   FILE *fp;
 
   fp = file->stream;
+  if(!fp)
+    return -1;
   return(fileno(fp));
   }
 
+/* Write the header of a file into memory. The temporary handle gets
+   the same settings as the file but writes into a memory buffer. */
+
+static quicktime_t * header_open(quicktime_t * file,
+                                 uint8_t ** data, int64_t * len)
+  {
+  quicktime_t * tmp;
+  tmp = malloc(sizeof(*tmp));
+  memcpy(tmp, file, sizeof(*tmp));
+  tmp->rd = 0;
+  tmp->wr = 1;
+  tmp->stream = NULL;
+  memset(&tmp->io, 0, sizeof(tmp->io));
+  tmp->io_priv = NULL;
+  tmp->writer = NULL;
+  tmp->readahead = NULL;
+  tmp->interleave = NULL;
+  tmp->fragment = NULL;
+  tmp->path = NULL;
+  tmp->chunk_map = NULL;
+  tmp->chunk_map_size = 0;
+  tmp->mmap_buffer = NULL;
+  tmp->mmap_size = 0;
+  tmp->expected_size = 0;
+  tmp->allocated_size = 0;
+  tmp->io_error = 0;
+  tmp->file_position = 0;
+  tmp->ftell_position = 0;
+  tmp->total_length = 0;
+  tmp->presave_size = 0;
+  tmp->presave_position = 0;
+  tmp->presave_buffer = NULL;
+
+  if(quicktime_file_open_write_memory(tmp, data, len))
+    {
+    free(tmp);
+    return NULL;
+    }
+  return tmp;
+  }
+
+/* Returns 1 on success, the data are in the buffer passed to header_open() */
+
+static int header_close(quicktime_t * tmp)
+  {
+  int result = !tmp->io_error;
+  quicktime_file_close(tmp);
+  free(tmp->presave_buffer);
+  free(tmp);
+  return result;
+  }
+
+/* ftyp, moov, a free atom of pad bytes (if nonzero) and the 64 bit
+   mdat header */
+
+static int render_streamable_header(quicktime_t * file, int64_t pad,
+                                    int64_t mdat_size,
+                                    uint8_t ** data, int64_t * len)
+  {
+  quicktime_t * tmp;
+  uint8_t buf[1024];
+  int64_t pos;
+
+  if(!(tmp = header_open(file, data, len)))
+    return 0;
+
+  if(file->has_ftyp)
+    quicktime_write_ftyp(tmp, &file->ftyp);
+  quicktime_write_moov(tmp, &file->moov);
+
+  if(pad)
+    {
+    quicktime_write_int32(tmp, pad);
+    quicktime_write_char32(tmp, "free");
+    memset(buf, 0, sizeof(buf));
+    for(pos = 8; pos < pad; pos += sizeof(buf))
+      quicktime_write_data(tmp, buf,
+                           (pad - pos > sizeof(buf)) ? sizeof(buf) : pad - pos);
+    }
+
+  quicktime_write_int32(tmp, 1);
+  quicktime_write_char32(tmp, "mdat");
+  quicktime_write_int64(tmp, mdat_size);
+
+  if(!header_close(tmp))
+    {
+    free(*data);
+    *data = NULL;
+    return 0;
+    }
+  return 1;
+  }
+
+/* Low level I/O for moving the media data */
+
+#define COPY_BUFFER_SIZE (8*1024*1024)
+
+static int pwrite_all(int fd, const uint8_t * data, int64_t len, int64_t offset)
+  {
+  ssize_t result;
+  while(len > 0)
+    {
+    result = pwrite(fd, data, len, offset);
+    if(result <= 0)
+      {
+      if((result < 0) && (errno == EINTR))
+        continue;
+      return 0;
+      }
+    data += result;
+    offset += result;
+    len -= result;
+    }
+  return 1;
+  }
+
+static int pread_all(int fd, uint8_t * data, int64_t len, int64_t offset)
+  {
+  ssize_t result;
+  while(len > 0)
+    {
+    result = pread(fd, data, len, offset);
+    if(result <= 0)
+      {
+      if((result < 0) && (errno == EINTR))
+        continue;
+      return 0;
+      }
+    data += result;
+    offset += result;
+    len -= result;
+    }
+  return 1;
+  }
+
+/* Copy len bytes between two files. The kernel can do this without
+   passing the data through userspace (or even share the blocks on
+   filesystems supporting reflinks). If this isn't supported, we
+   fall back to a read/write loop. */
+
+static int copy_range(int in_fd, int64_t in_offset,
+                      int out_fd, int64_t out_offset, int64_t len)
+  {
+  uint8_t * buffer;
+  int64_t bytes;
+  int result = 1;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  loff_t in_off = in_offset, out_off = out_offset;
+  ssize_t copied;
+
+  while(len > 0)
+    {
+    copied = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+    if(copied <= 0)
+      {
+      if((copied < 0) && (errno == EINTR))
+        continue;
+      break;
+      }
+    len -= copied;
+    }
+  in_offset = in_off;
+  out_offset = out_off;
+  if(!len)
+    return 1;
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  if(lseek(out_fd, out_offset, SEEK_SET) == out_offset)
+    {
+    off_t off = in_offset;
+    ssize_t sent;
+    
+    while(len > 0)
+      {
+      sent = sendfile(out_fd, in_fd, &off,
+                      (len > 0x40000000) ? 0x40000000 : len);
+      if(sent <= 0)
+        {
+        if((sent < 0) && (errno == EINTR))
+          continue;
+        break;
+        }
+      len -= sent;
+      out_offset += sent;
+      }
+    in_offset = off;
+    if(!len)
+      return 1;
+    }
+#endif
+
+  if(!(buffer = malloc(COPY_BUFFER_SIZE)))
+    return 0;
+  
+  while(len > 0)
+    {
+    bytes = (len > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : len;
+    if(!pread_all(in_fd, buffer, bytes, in_offset) ||
+       !pwrite_all(out_fd, buffer, bytes, out_offset))
+      {
+      result = 0;
+      break;
+      }
+    in_offset += bytes;
+    out_offset += bytes;
+    len -= bytes;
+    }
+  free(buffer);
+  return result;
+  }
+
+/* Move len bytes within one file. Overlapping ranges cannot be passed
+   to the kernel, so we copy backwards (or forwards) in large blocks */
+
+static int move_range(int fd, int64_t from, int64_t to, int64_t len)
+  {
+  uint8_t * buffer;
+  int64_t bytes, pos;
+  int result = 1;
+
+  if(from == to)
+    return 1;
+
+  if(!(buffer = malloc(COPY_BUFFER_SIZE)))
+    return 0;
+
+  if(to > from)
+    {
+    pos = len;
+    while(pos > 0)
+      {
+      bytes = (pos > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : pos;
+      pos -= bytes;
+      if(!pread_all(fd, buffer, bytes, from + pos) ||
+         !pwrite_all(fd, buffer, bytes, to + pos))
+        {
+        result = 0;
+        break;
+        }
+      }
+    }
+  else
+    {
+    pos = 0;
+    while(pos < len)
+      {
+      bytes = (len - pos > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : len - pos;
+      if(!pread_all(fd, buffer, bytes, from + pos) ||
+         !pwrite_all(fd, buffer, bytes, to + pos))
+        {
+        result = 0;
+        break;
+        }
+      pos += bytes;
+      }
+    }
+  free(buffer);
+  return result;
+  }
+
+static int same_file(const char * path1, const char * path2)
+  {
+  struct stat st1, st2;
+  if(!strcmp(path1, path2))
+    return 1;
+  if(stat(path1, &st1) || stat(path2, &st2))
+    return 0;
+  return (st1.st_dev == st2.st_dev) && (st1.st_ino == st2.st_ino);
+  }
+
 int quicktime_make_streamable(char *in_path, char *out_path)
   {
-  quicktime_t file, *old_file, new_file;
-  int moov_exists = 0, mdat_exists = 0, ftyp_exists = 0, result, atoms = 1;
-  int64_t mdat_start = 0, mdat_size = 0;
+  quicktime_t file, *old_file;
+  int moov_exists = 0, mdat_exists = 0, result, atoms = 1;
+  int64_t mdat_payload = 0, mdat_end = 0;
   quicktime_atom_t leaf_atom;
-  int64_t moov_length = 0, moov_start;
-        
-  memset(&new_file,0,sizeof(new_file));
-        
+  int64_t payload_start, header_len, pad = 0, gap;
+  uint8_t * header = NULL;
+  int in_place, in_fd, out_fd;
+
+  in_place = !out_path || same_file(in_path, out_path);
+  
   quicktime_init(&file);
 
   /* find the moov atom in the old file */
@@ -85,20 +368,22 @@ int quicktime_make_streamable(char *in_path, char *out_path)
       if(quicktime_atom_is(&leaf_atom, "moov"))
         {
         moov_exists = atoms;
-        moov_length = leaf_atom.size;
         }
       else
-        if(quicktime_atom_is(&leaf_atom, "ftyp"))
+        if(quicktime_atom_is(&leaf_atom, "mdat"))
           {
-          ftyp_exists = atoms;
+          mdat_payload = quicktime_position(&file);
+          mdat_end = leaf_atom.end;
+          mdat_exists = atoms;
+          }
+      else
+        if(quicktime_atom_is(&leaf_atom, "moof"))
+          {
+          fclose(file.stream);
+          lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
+                  "quicktime_make_streamable: fragmented files are not supported");
+          return 1;
           }
-        else
-          if(quicktime_atom_is(&leaf_atom, "mdat"))
-            {
-            mdat_start = quicktime_position(&file) - HEADER_LENGTH;
-            mdat_size = leaf_atom.size;
-            mdat_exists = atoms;
-            }
 
       quicktime_atom_skip(&file, &leaf_atom);
 
@@ -122,120 +407,112 @@ int quicktime_make_streamable(char *in_path, char *out_path)
     return 1;
     }
 
-  /* copy the old file to the new file */
-  if(moov_exists && mdat_exists)
+  if(moov_exists < mdat_exists)
     {
-    /* moov comes after mdat */
-    if(moov_exists > mdat_exists)
-      {
-      uint8_t *buffer;
-      int64_t buf_size = 1000000;
+    printf("quicktime_make_streamable: header already at 0 offset\n");
+    return 0;
+    }
+  
+  /* read the header proper */
+  if(!(old_file = quicktime_open(in_path, 1, 0)))
+    return 1;
 
-      result = 0;
+  /* Get the size of the new header */
+  if(!render_streamable_header(old_file, 0, mdat_end - mdat_payload + 16,
+                               &header, &header_len))
+    {
+    quicktime_close(old_file);
+    return 1;
+    }
+  free(header);
+  header = NULL;
 
-      /* read the header proper */
-      if(!(old_file = quicktime_open(in_path, 1, 0)))
-        {
-        return 1;
-        }
+  payload_start = header_len;
 
-      quicktime_shift_offsets(&old_file->moov, moov_length+8);
+  /* When converting in place, the media data are moved only if
+     the header doesn't fit in front of them. A gap is filled with
+     a free atom. */
+  if(in_place)
+    {
+    gap = mdat_payload - header_len;
+    if(!gap || (gap >= 8))
+      {
+      pad = gap;
+      payload_start = mdat_payload;
+      }
+    else if(gap > 0)
+      {
+      pad = 8;
+      payload_start = header_len + 8;
+      }
+    }
 
-      /* open the output file */
-			
-			
-      if(!(new_file.stream = fopen(out_path, "wb")))
-        {
-        lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
-                "quicktime_make_streamable: cannot open output file: %s",
-                strerror(errno));
-        result =  1;
-        }
-      else
-        {
-        /* set up some flags */
-        new_file.wr = 1;
-        new_file.rd = 0;
-        new_file.presave_buffer = calloc(1, QUICKTIME_PRESAVE);
-        new_file.file_type = old_file->file_type;
-        if(old_file->has_ftyp)
-          quicktime_write_ftyp(&new_file, &old_file->ftyp);
-                        
-        moov_start = quicktime_position(&new_file);
-        quicktime_write_moov(&new_file, &old_file->moov);
-
-        if(moov_length !=
-           quicktime_position(&new_file) - moov_start)
-          {
-          lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
-                  "quicktime_make_streamable: moov size changed from %"PRId64" to %"PRId64" (Pos: %"PRId64", start: %"PRId64")",
-                  moov_length, quicktime_position(&new_file) - moov_start,
-                  quicktime_position(&new_file), moov_start);
-          quicktime_set_position(&new_file, moov_start + moov_length);
-          }
-                          
-				
+  quicktime_shift_offsets(&old_file->moov, payload_start - mdat_payload);
 
-        quicktime_atom_write_header64(&new_file, 
-                                         
-                                      &new_file.mdat.atom, 
-                                      "mdat");
-				
-        quicktime_set_position(old_file, mdat_start);
+  result = !render_streamable_header(old_file, pad, mdat_end - mdat_payload + 16,
+                                     &header, &header_len);
+  quicktime_close(old_file);
 
-        if(!(buffer = calloc(1, buf_size)))
-          {
-          result = 1;
-          printf("quicktime_make_streamable: out of memory\n");
-          }
-        else
-          {
-          while(quicktime_position(old_file) < mdat_start +
-                mdat_size && !result)
-            {
-            if(quicktime_position(old_file) + buf_size >
-               mdat_start + mdat_size)
-              buf_size = mdat_start + mdat_size -
-                quicktime_position(old_file);
-
-            if(!quicktime_read_data(old_file, buffer, buf_size))
-              result = 1;
-            if(!result)
-              {
-              if(!quicktime_write_data(&new_file, buffer,
-                                       buf_size)) result = 1;
- 
-              }
-            }
-          free(buffer);
-          }
+  if(result)
+    return 1;
+  
+  if(header_len != payload_start)
+    {
+    lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
+            "quicktime_make_streamable: header size changed from %"PRId64" to %"PRId64,
+            payload_start, header_len);
+    free(header);
+    return 1;
+    }
 
-        quicktime_atom_write_footer(&new_file, 
-                                         
-                                    &new_file.mdat.atom);
-			
-				
-        if(new_file.presave_size)
-          {
-          quicktime_fseek(&new_file,
-                          new_file.presave_position - new_file.presave_size);
-          fwrite(new_file.presave_buffer, 1,
-                 new_file.presave_size, new_file.stream);
-          new_file.presave_size = 0;
-          }
-        free(new_file.presave_buffer);
-        fclose(new_file.stream);
-        }
-      quicktime_close(old_file);
+  if(in_place)
+    {
+    if((in_fd = open(in_path, O_RDWR)) < 0)
+      {
+      lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
+              "quicktime_make_streamable: cannot open file: %s",
+              strerror(errno));
+      free(header);
+      return 1;
       }
-    else
+    /* Media data first, the old header at the end is overwritten */
+    if(!move_range(in_fd, mdat_payload, payload_start, mdat_end - mdat_payload) ||
+       !pwrite_all(in_fd, header, header_len, 0) ||
+       ftruncate(in_fd, payload_start + mdat_end - mdat_payload))
+      result = 1;
+    close(in_fd);
+    }
+  else
+    {
+    if((in_fd = open(in_path, O_RDONLY)) < 0)
       {
-      printf("quicktime_make_streamable: header already at 0 offset\n");
-      return 0;
+      perror("quicktime_make_streamable");
+      free(header);
+      return 1;
+      }
+    if((out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+      {
+      lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
+              "quicktime_make_streamable: cannot open output file: %s",
+              strerror(errno));
+      close(in_fd);
+      free(header);
+      return 1;
       }
+    if(!pwrite_all(out_fd, header, header_len, 0) ||
+       !copy_range(in_fd, mdat_payload, out_fd, payload_start,
+                   mdat_end - mdat_payload))
+      result = 1;
+    close(in_fd);
+    if(close(out_fd))
+      result = 1;
     }
-	
-  return 0;
+  free(header);
+
+  if(result)
+    lqt_log(NULL, LQT_LOG_ERROR, LOG_DOMAIN,
+            "quicktime_make_streamable: writing failed: %s", strerror(errno));
+  return result;
   }
 
 
@@ -711,6 +988,18 @@ static int quicktime_delete(quicktime_t *file)
 
   if(file->moov_data)
     free(file->moov_data);
+
+  if(file->chunk_map)
+    free(file->chunk_map);
+
+  if(file->path)
+    free(file->path);
+
+  if(file->fragment)
+    quicktime_fragment_delete(file);
+
+  if(file->interleave)
+    quicktime_interleave_delete(file);
         
   if(file->preload_size)
     {
@@ -741,6 +1030,9 @@ int quicktime_set_cpus(quicktime_t *file, int cpus)
 
 void quicktime_set_preload(quicktime_t *file, int64_t preload)
   {
+  /* A mapped file doesn't need a read ahead buffer */
+  if(file->mmap_buffer)
+    return;
   file->preload_size = preload;
   if(file->preload_buffer) free(file->preload_buffer);
   file->preload_buffer = 0;
@@ -811,6 +1103,8 @@ int quicktime_set_audio_position(quicktime_t *file, int64_t sample, int track)
     
     file->atracks[track].current_position = sample;
     file->atracks[track].eof = 0;
+    file->atracks[track].packets_failed = 0;
+    file->chunk_map_pos = 0;
     }
   else
     lqt_log(file, LQT_LOG_ERROR, LOG_DOMAIN,
@@ -833,6 +1127,8 @@ int quicktime_set_video_position(quicktime_t *file, int64_t frame, int track)
     return 0;
   
   file->vtracks[track].current_position = frame;
+  file->vtracks[track].packets_failed = 0;
+  file->chunk_map_pos = 0;
   quicktime_chunk_of_sample(&chunk_sample, &chunk, trak, frame);
   file->vtracks[track].cur_chunk = chunk;
   
@@ -842,6 +1138,12 @@ int quicktime_set_video_position(quicktime_t *file, int64_t frame, int track)
                              &file->vtracks[track].stts_index,
                              &file->vtracks[track].stts_count);
 
+  if(trak->mdia.minf.stbl.has_ctts)
+    quicktime_sample_to_ctts(&trak->mdia.minf.stbl.ctts,
+                             frame,
+                             &file->vtracks[track].ctts_index,
+                             &file->vtracks[track].ctts_count);
+
   /* Resync codec */
 
   codec = file->vtracks[track].codec;
@@ -921,11 +1223,55 @@ int lqt_read_video_frame(quicktime_t * file,
     return 0;
     }
   memset(*buffer + len, 0, FRAME_PADDING);
+
+  if(file->readahead)
+    quicktime_readahead_video(file, track, frame);
   return len;
   }
 
 #undef FRAME_PADDING
 
+int lqt_peek_video_frame(quicktime_t * file, int track, int64_t frame,
+                         const uint8_t ** data, int * len)
+  {
+  int64_t offset, chunk_sample, chunk;
+  quicktime_trak_t *trak;
+  quicktime_video_map_t * vtrack;
+  
+  if((track >= file->total_vtracks) || (track < 0))
+    return 0;
+
+  vtrack = &file->vtracks[track];
+  trak = vtrack->track;
+
+  if((frame < 0) || (frame >= quicktime_track_samples(file, trak)))
+    return 0;
+
+  quicktime_chunk_of_sample(&chunk_sample, &chunk, trak, frame);
+  vtrack->cur_chunk = chunk;
+  offset = quicktime_sample_to_offset(file, trak, frame);
+  quicktime_set_position(file, offset);
+
+  *len = quicktime_frame_size(file, frame, track);
+
+  /* Zero copy if the frame is inside the mapping */
+  if((*data = quicktime_peek_data(file, *len)))
+    {
+    if(file->readahead)
+      quicktime_readahead_video(file, track, frame);
+    return 1;
+    }
+
+  /* Copy into our own buffer */
+  if(!lqt_read_video_frame(file, &vtrack->peek_buffer,
+                           &vtrack->peek_buffer_alloc,
+                           frame, NULL, track) && *len)
+    return 0;
+  
+  *data = vtrack->peek_buffer;
+  return 1;
+  }
+
 
 int quicktime_has_audio(quicktime_t *file)
   {
@@ -1388,10 +1734,7 @@ int quicktime_read_frame_init(quicktime_t *file, int track)
   quicktime_set_position(file, offset);
   
   if(quicktime_ftell(file) != file->file_position) 
-    {
-    fseeko(file->stream, file->file_position, SEEK_SET);
-    file->ftell_position = file->file_position;
-    }
+    quicktime_fseek(file, file->file_position);
   return 0;
   }
 
@@ -1427,34 +1770,44 @@ long quicktime_get_keyframe_before(quicktime_t *file, long frame, int track)
   {
   quicktime_trak_t *trak = file->vtracks[track].track;
   quicktime_stss_t *stss = &trak->mdia.minf.stbl.stss;
-  int i;
+  long i;
   
   // Offset 1
-  frame++;
+  i = quicktime_stss_find(stss, frame + 1);
   
-  for(i = stss->total_entries - 1; i >= 0; i--)
-    {
-    if(stss->table[i].sample <= frame) return stss->table[i].sample - 1;
-    }
-
+  if(i >= 0)
+    return stss->table[i].sample - 1;
   return 0;
   }
 
-#if 0
-static long quicktime_get_keyframe_after(quicktime_t *file, long frame, int track)
+long quicktime_get_keyframe_after(quicktime_t *file, long frame, int track)
   {
   quicktime_trak_t *trak = file->vtracks[track].track;
   quicktime_stss_t *stss = &trak->mdia.minf.stbl.stss;
-  int i;
+  long i;
+
   // Offset 1
   frame++;
-  for(i = 0; i < stss->total_entries; i++)
+
+  if(!stss->sorted)
     {
-    if(stss->table[i].sample >= frame) return stss->table[i].sample - 1;
+    long ret = -1;
+    for(i = 0; i < stss->total_entries; i++)
+      {
+      if((stss->table[i].sample >= frame) &&
+         ((ret < 0) || (stss->table[i].sample < ret)))
+        ret = stss->table[i].sample;
+      }
+    return (ret < 0) ? 0 : ret - 1;
     }
+  
+  /* First entry >= frame */
+  i = quicktime_stss_find(stss, frame - 1) + 1;
+
+  if(i < stss->total_entries)
+    return stss->table[i].sample - 1;
   return 0;
   }
-#endif
 
 void quicktime_insert_keyframe(quicktime_t *file, long frame, int track)
   {
@@ -1473,10 +1826,21 @@ void quicktime_insert_keyframe(quicktime_t *file, long frame, int track)
       }
     }
   
+  if(stss->total_entries &&
+     (stss->table[stss->total_entries-1].sample >= frame+1))
+    stss->sorted = 0;
+
+  if(stss->bitmap)
+    {
+    free(stss->bitmap);
+    stss->bitmap = NULL;
+    stss->bitmap_samples = 0;
+    }
+  
   // Expand table
   if(stss->entries_allocated <= stss->total_entries)
     {
-    stss->entries_allocated += 1024;
+    stss->entries_allocated = stss->entries_allocated * 2 + 1024;
     stss->table = realloc(stss->table,
                           sizeof(*stss->table) *
                           stss->entries_allocated);
@@ -1497,20 +1861,12 @@ int quicktime_has_keyframes(quicktime_t *file, int track)
 
 int lqt_is_keyframe(quicktime_t *file, int track, int frame)
   {
-  int i;
   quicktime_stss_t *stss = &file->vtracks[track].track->mdia.minf.stbl.stss;
 
   if(!stss->total_entries)
     return 1;
 
-  frame++;
-  
-  for(i = 0; i < stss->total_entries; i++)
-    {
-    if(stss->table[i].sample == frame)
-      return 1;
-    }
-  return 0;
+  return quicktime_stss_is_sync(stss, frame + 1);
   }
 
 
@@ -1530,12 +1886,20 @@ int quicktime_delete_video_map(quicktime_video_map_t *vtrack)
   quicktime_delete_codec(vtrack->codec);
   if(vtrack->temp_frame)
     lqt_rows_free(vtrack->temp_frame);
+  if(vtrack->cmodel_plan)
+    lqt_cmodel_plan_destroy(vtrack->cmodel_plan);
+  if(vtrack->thread_pool)
+    quicktime_thread_pool_destroy(vtrack->thread_pool);
   if(vtrack->timecodes)
     free(vtrack->timecodes);
   if(vtrack->timestamps)
     free(vtrack->timestamps);
   if(vtrack->picture_numbers)
     free(vtrack->picture_numbers);
+  if(vtrack->pts_hash)
+    free(vtrack->pts_hash);
+  if(vtrack->peek_buffer)
+    free(vtrack->peek_buffer);
   
   lqt_compression_info_free(&vtrack->ci);
         
@@ -1571,6 +1935,8 @@ int quicktime_delete_audio_map(quicktime_audio_map_t *atrack)
     free(atrack->sample_buffer);
   if(atrack->channel_setup)
     free(atrack->channel_setup);
+  if(atrack->peek_buffer)
+    free(atrack->peek_buffer);
   lqt_compression_info_free(&atrack->ci);
   return 0;
   }
@@ -1778,23 +2144,40 @@ int quicktime_read_info(quicktime_t *file)
             else
               if(quicktime_atom_is(&leaf_atom, "moov"))
                 {
-                /* Set preload and preload the moov atom here */
-                int64_t start_position = quicktime_position(file);
-                long temp_size = leaf_atom.end - start_position;
-                unsigned char *temp = malloc(temp_size);
-                quicktime_set_preload(file,
-                                      (temp_size < 0x100000) ? 0x100000 : temp_size);
-                quicktime_read_data(file, temp, temp_size);
-                quicktime_set_position(file, start_position);
-                free(temp);
+                /* Set preload and preload the moov atom here.
+                   Not needed if the file is memory mapped */
+                if(!file->mmap_buffer)
+                  {
+                  int64_t start_position = quicktime_position(file);
+                  long temp_size = leaf_atom.end - start_position;
+                  unsigned char *temp = malloc(temp_size);
+                  quicktime_set_preload(file,
+                                        (temp_size < 0x100000) ? 0x100000 : temp_size);
+                  quicktime_read_data(file, temp, temp_size);
+                  quicktime_set_position(file, start_position);
+                  free(temp);
+                  }
 
                 quicktime_read_moov(file, &file->moov, &leaf_atom);
                 got_header = 1;
                 }
+              else
+                if(got_header && file->fragment &&
+                   (quicktime_atom_is(&leaf_atom, "moof") ||
+                    quicktime_atom_is(&leaf_atom, "sidx")))
+                  {
+                  /* Returns 1 if the index made reading the
+                     other atoms unnecessary */
+                  if(quicktime_fragment_read(file, &leaf_atom))
+                    break;
+                  }
               else
                 quicktime_atom_skip(file, &leaf_atom);
           }
         }while(!result && quicktime_position(file) < file->total_length);
+
+      if(file->fragment)
+        quicktime_fragment_finish_read(file);
 		
       /* read QTVR sample atoms -- object */
       if (lqt_qtvr_get_object_track(file) >= 0)
@@ -1983,12 +2366,13 @@ static int quicktime_is_avi(quicktime_t *file)
   }
 #endif
 
-static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_t type,
-                            lqt_log_callback_t log_cb, void * log_data)
+/* Opening is done in 3 steps: Create the handle, open the I/O
+   (file, custom callbacks or memory) and read or start the file */
+
+static quicktime_t* open_create(int rd, int wr, lqt_file_type_t type,
+                                lqt_log_callback_t log_cb, void * log_data)
   {
-  int i;
   quicktime_t *new_file;
-  int result = 0;
 
   new_file = calloc(1, sizeof(*new_file));
 
@@ -2008,6 +2392,13 @@ static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_
   new_file->mdat.atom.start = 0;
   if(wr)
     {
+    /* Fragmented files are MP4 files for everything except the
+       writing of the sample tables */
+    if(type == LQT_FILE_MP4_FRAGMENTED)
+      {
+      type = LQT_FILE_MP4;
+      quicktime_fragment_init(new_file);
+      }
     new_file->file_type = type;
     quicktime_ftyp_init(&new_file->ftyp, type);
     if(new_file->ftyp.major_brand)
@@ -2017,7 +2408,12 @@ static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_
     if(new_file->file_type & LQT_FILE_MP4)
       new_file->moov.has_iods = 1;
     }
-  result = quicktime_file_open(new_file, filename, rd, wr);
+  return new_file;
+  }
+
+static quicktime_t* open_finish(quicktime_t *new_file, int result, int rd, int wr)
+  {
+  int i;
 
   if(!result)
     {
@@ -2037,9 +2433,11 @@ static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_
       {
       if(new_file->has_ftyp)
         quicktime_write_ftyp(new_file, &new_file->ftyp);
-      quicktime_atom_write_header64(new_file, 
-                                    &new_file->mdat.atom, 
-                                    "mdat");
+      /* Fragmented files have one mdat atom per fragment */
+      if(!new_file->fragment)
+        quicktime_atom_write_header64(new_file, 
+                                      &new_file->mdat.atom, 
+                                      "mdat");
       }
     }
   else
@@ -2051,7 +2449,11 @@ static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_
     if (new_file->stream)
       quicktime_close(new_file);
     else
+      {
+      if(new_file->presave_buffer)
+        free(new_file->presave_buffer);
       free(new_file);
+      }
     new_file = 0;
     }
         
@@ -2070,6 +2472,19 @@ static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_
   return new_file;
   }
 
+static quicktime_t* do_open(const char *filename, int rd, int wr, lqt_file_type_t type,
+                            lqt_log_callback_t log_cb, void * log_data)
+  {
+  quicktime_t *new_file;
+
+  if(!(new_file = open_create(rd, wr, type, log_cb, log_data)))
+    return NULL;
+  
+  return open_finish(new_file,
+                     quicktime_file_open(new_file, filename, rd, wr),
+                     rd, wr);
+  }
+
 quicktime_t* quicktime_open(const char *filename, int rd, int wr)
   {
   return do_open(filename, rd, wr, LQT_FILE_QT_OLD, NULL, NULL);
@@ -2097,11 +2512,152 @@ quicktime_t * lqt_open_write_with_log(const char * filename, lqt_file_type_t typ
   return do_open(filename, 0, 1, type, cb, log_data);
   }
 
+quicktime_t * lqt_open_read_io(const lqt_io_callbacks_t * io, void * priv)
+  {
+  quicktime_t *new_file;
+
+  if(!(new_file = open_create(1, 0, LQT_FILE_NONE, NULL, NULL)))
+    return NULL;
+  
+  return open_finish(new_file,
+                     quicktime_file_open_io(new_file, io, priv, 1, 0),
+                     1, 0);
+  }
+
+quicktime_t * lqt_open_write_io(const lqt_io_callbacks_t * io, void * priv,
+                                lqt_file_type_t type)
+  {
+  quicktime_t *new_file;
+
+  if(!(new_file = open_create(0, 1, type, NULL, NULL)))
+    return NULL;
+  
+  return open_finish(new_file,
+                     quicktime_file_open_io(new_file, io, priv, 0, 1),
+                     0, 1);
+  }
+
+quicktime_t * lqt_open_read_memory(const uint8_t * data, int64_t len)
+  {
+  quicktime_t *new_file;
+
+  if(!(new_file = open_create(1, 0, LQT_FILE_NONE, NULL, NULL)))
+    return NULL;
+  
+  return open_finish(new_file,
+                     quicktime_file_open_memory(new_file, data, len),
+                     1, 0);
+  }
+
+quicktime_t * lqt_open_write_memory(lqt_file_type_t type,
+                                    uint8_t ** data, int64_t * len)
+  {
+  quicktime_t *new_file;
+
+  if(!(new_file = open_create(0, 1, type, NULL, NULL)))
+    return NULL;
+  
+  return open_finish(new_file,
+                     quicktime_file_open_write_memory(new_file, data, len),
+                     0, 1);
+  }
+
+
+int lqt_set_faststart(quicktime_t * file, int64_t reserve)
+  {
+  int64_t pos;
+  uint8_t buf[1024];
+  
+  /* Only possible if nothing but the mdat header was written */
+  if(!file->wr || (file->file_type & (LQT_FILE_AVI|LQT_FILE_AVI_ODML)) ||
+     file->fragment ||
+     file->moov_reserve_size || (reserve < 8) ||
+     (quicktime_position(file) != file->mdat.atom.start + 16))
+    return 1;
+
+  /* Replace the mdat header by a free atom followed by the mdat header */
+  quicktime_set_position(file, file->mdat.atom.start);
+  file->moov_reserve_start = file->mdat.atom.start;
+  file->moov_reserve_size = reserve;
+  
+  quicktime_write_int32(file, reserve);
+  quicktime_write_char32(file, "free");
+
+  memset(buf, 0, sizeof(buf));
+  pos = 8;
+  while(pos < reserve)
+    {
+    quicktime_write_data(file, buf,
+                         (reserve - pos > sizeof(buf)) ? sizeof(buf) : reserve - pos);
+    pos += sizeof(buf);
+    }
+  quicktime_set_position(file, file->moov_reserve_start + reserve);
+  quicktime_atom_write_header64(file, &file->mdat.atom, "mdat");
+  return 0;
+  }
+
+/* Write the moov atom into the space reserved by lqt_set_faststart().
+   The atom is first written into memory to get its size. Since the
+   media data don't move, the chunk offsets stay the same. */
+
+static int write_moov_reserved(quicktime_t *file)
+  {
+  quicktime_t * tmp;
+  uint8_t * data = NULL;
+  int64_t len = 0;
+  int64_t end;
+  int result = 0;
+
+  if((tmp = header_open(file, &data, &len)))
+    {
+    quicktime_write_moov(tmp, &file->moov);
+    result = header_close(tmp);
+    }
+
+  /* The rest must be large enough for a free atom */
+  if(!result || (len > file->moov_reserve_size) ||
+     ((len < file->moov_reserve_size) && (len + 8 > file->moov_reserve_size)))
+    {
+    if(result)
+      lqt_log(file, LQT_LOG_INFO, LOG_DOMAIN,
+              "Header (%"PRId64" bytes) doesn't fit into reserved space (%"PRId64" bytes)",
+              len, file->moov_reserve_size);
+    if(data)
+      free(data);
+    return 0;
+    }
+
+  end = quicktime_position(file);
+  quicktime_set_position(file, file->moov_reserve_start);
+  quicktime_write_data(file, data, len);
+
+  if(len < file->moov_reserve_size)
+    {
+    quicktime_write_int32(file, file->moov_reserve_size - len);
+    quicktime_write_char32(file, "free");
+    }
+  quicktime_set_position(file, end);
+  free(data);
+  return 1;
+  }
+
+/* Check if the path still refers to the file we wrote */
+
+static int is_written_file(quicktime_t * file)
+  {
+  struct stat st1, st2;
+  if(!file->path || !file->stream ||
+     fstat(fileno(file->stream), &st1) || stat(file->path, &st2))
+    return 0;
+  return S_ISREG(st1.st_mode) &&
+    (st1.st_dev == st2.st_dev) && (st1.st_ino == st2.st_ino);
+  }
 
 int quicktime_close(quicktime_t *file)
   {
   int i;
   int result = 0;
+  int relocate = 0;
   if(file->wr)
     {
     /* Finish final chunk if necessary */
@@ -2112,6 +2668,10 @@ int quicktime_close(quicktime_t *file)
 
     for(i = 0; i < file->total_vtracks; i++)
       {
+      /* Fragmented files have no complete tables */
+      if(file->fragment)
+        break;
+
       lqt_video_build_timestamp_tables(file, i);
 
       /* Fix stts for timecode track */
@@ -2124,6 +2684,13 @@ int quicktime_close(quicktime_t *file)
         lqt_flush_timecode(file, i, duration, 1);
         }
       }
+    /* Write the interleaved chunks */
+    if(file->interleave)
+      {
+      if(file->write_trak)
+        quicktime_write_chunk_footer(file, file->write_trak);
+      quicktime_interleave_flush(file);
+      }
     if(file->file_type & (LQT_FILE_AVI|LQT_FILE_AVI_ODML))
       {
 #if 0
@@ -2147,6 +2714,11 @@ int quicktime_close(quicktime_t *file)
           }
         }
       }
+    else if(file->fragment)
+      {
+      if(quicktime_fragment_close(file))
+        result = 1;
+      }
     else
       {
       if (lqt_qtvr_get_object_track(file) >= 0)
@@ -2160,10 +2732,27 @@ int quicktime_close(quicktime_t *file)
       // Atoms are only written here
       quicktime_atom_write_footer(file, &file->mdat.atom);
       quicktime_finalize_moov(file, &file->moov);
-      quicktime_write_moov(file, &file->moov);
+      if(!file->moov_reserve_size || !write_moov_reserved(file))
+        {
+        quicktime_write_moov(file, &file->moov);
+        /* Move it to the start after the file is closed */
+        if(file->moov_reserve_size)
+          relocate = is_written_file(file) ? 1 : -1;
+        }
       }
     }
   quicktime_file_close(file);
+
+  if(relocate)
+    {
+    if((relocate < 0) || file->io_error ||
+       quicktime_make_streamable(file->path, NULL))
+      {
+      lqt_log(file, LQT_LOG_WARNING, LOG_DOMAIN,
+              "Header could not be moved to the start of the file");
+      result = 1;
+      }
+    }
   quicktime_delete(file);
   free(file);
   return result;
@@ -2299,70 +2888,261 @@ int lqt_get_wav_id(quicktime_t *file, int track)
   return trak->mdia.minf.stbl.stsd.table[0].compression_id;
   }
 
-int64_t * lqt_get_chunk_sizes(quicktime_t * file, quicktime_trak_t *trak)
+/* Global chunk map */
+
+static int compare_chunks(const void * p1, const void * p2)
   {
-  int i, j;
-  int64_t * ret;
+  const quicktime_chunk_map_t * c1 = p1;
+  const quicktime_chunk_map_t * c2 = p2;
+
+  if(c1->offset != c2->offset)
+    return (c1->offset < c2->offset) ? -1 : 1;
+  if(c1->trak != c2->trak)
+    return (c1->trak < c2->trak) ? -1 : 1;
+  if(c1->chunk != c2->chunk)
+    return (c1->chunk < c2->chunk) ? -1 : 1;
+  return 0;
+  }
+
+/* Key of the next unmerged chunk of a track */
+
+#define HEAP_OFFSET(t) \
+  (file->moov.trak[t]->mdia.minf.stbl.stco.table[indices[t]].offset)
+
+#define HEAP_LESS(t1, t2) \
+  ((HEAP_OFFSET(t1) < HEAP_OFFSET(t2)) || \
+   ((HEAP_OFFSET(t1) == HEAP_OFFSET(t2)) && (t1 < t2)))
+
+static void heap_down(quicktime_t * file, int * heap, int heap_size,
+                      long * indices, int pos)
+  {
+  int child, tmp;
+
+  while((child = 2 * pos + 1) < heap_size)
+    {
+    if((child + 1 < heap_size) && HEAP_LESS(heap[child+1], heap[child]))
+      child++;
+    if(!HEAP_LESS(heap[child], heap[pos]))
+      break;
+    tmp = heap[child];
+    heap[child] = heap[pos];
+    heap[pos] = tmp;
+    pos = child;
+    }
+  }
+
+/* Merge the stco tables of all tracks. Since each table is (normally)
+   sorted already, this is a k-way merge of the tables. */
+
+int quicktime_build_chunk_map(quicktime_t * file)
+  {
+  int i, num_tracks, heap_size = 0, sorted = 1;
+  long j, first, num_chunks = 0, pos = 0;
+  int * heap;
+  long * indices;
   int64_t next_offset;
-  long num_chunks;
-  int num_tracks;
-  int * chunk_indices;
-  
-  num_chunks = trak->mdia.minf.stbl.stco.total_entries;
-  ret = calloc(num_chunks, sizeof(int64_t));
+  quicktime_stco_t * stco;
+  quicktime_trak_t * trak;
 
+  if(file->chunk_map)
+    return 1;
+  if(!file->rd)
+    return 0;
+  
   num_tracks = file->moov.total_tracks;
 
-  chunk_indices = malloc(num_tracks * sizeof(int));
-
   for(i = 0; i < num_tracks; i++)
     {
-    chunk_indices[i] = 0;
+    stco = &file->moov.trak[i]->mdia.minf.stbl.stco;
+    num_chunks += stco->total_entries;
+    for(j = 1; j < stco->total_entries; j++)
+      {
+      if(stco->table[j].offset < stco->table[j-1].offset)
+        {
+        sorted = 0;
+        break;
+        }
+      }
     }
-  
-  for(i = 0; i < num_chunks; i++)
+
+  if(!num_chunks)
+    return 0;
+
+  file->chunk_map = malloc(num_chunks * sizeof(*file->chunk_map));
+  file->chunk_map_size = num_chunks;
+
+  if(sorted)
     {
-    next_offset = -1;
-    for(j = 0; j < num_tracks; j++)
+    heap = malloc(num_tracks * sizeof(*heap));
+    indices = calloc(num_tracks, sizeof(*indices));
+    
+    for(i = 0; i < num_tracks; i++)
       {
-      if(chunk_indices[j] < 0)
-        continue;
+      if(file->moov.trak[i]->mdia.minf.stbl.stco.total_entries)
+        heap[heap_size++] = i;
+      }
+    for(i = heap_size / 2 - 1; i >= 0; i--)
+      heap_down(file, heap, heap_size, indices, i);
 
-      while(file->moov.trak[j]->mdia.minf.stbl.stco.table[chunk_indices[j]].offset <=
-            trak->mdia.minf.stbl.stco.table[i].offset)
+    while(heap_size)
+      {
+      i = heap[0];
+      file->chunk_map[pos].offset = HEAP_OFFSET(i);
+      file->chunk_map[pos].trak   = i;
+      file->chunk_map[pos].chunk  = indices[i];
+      pos++;
+      
+      indices[i]++;
+      if(indices[i] >= file->moov.trak[i]->mdia.minf.stbl.stco.total_entries)
+        heap[0] = heap[--heap_size];
+      heap_down(file, heap, heap_size, indices, 0);
+      }
+    free(heap);
+    free(indices);
+    }
+  else
+    {
+    for(i = 0; i < num_tracks; i++)
+      {
+      stco = &file->moov.trak[i]->mdia.minf.stbl.stco;
+      for(j = 0; j < stco->total_entries; j++)
         {
-        if(chunk_indices[j] >=
-           file->moov.trak[j]->mdia.minf.stbl.stco.total_entries - 1)
-          {
-          chunk_indices[j] = -1;
-          break;
-          }
-        else
-          chunk_indices[j]++;
+        file->chunk_map[pos].offset = stco->table[j].offset;
+        file->chunk_map[pos].trak   = i;
+        file->chunk_map[pos].chunk  = j;
+        pos++;
         }
-      if(chunk_indices[j] < 0)
-        continue;
-      if((next_offset == -1) ||
-         (file->moov.trak[j]->mdia.minf.stbl.stco.table[chunk_indices[j]].offset <
-          next_offset))
-        next_offset = file->moov.trak[j]->mdia.minf.stbl.stco.table[chunk_indices[j]].offset;
       }
-    if(next_offset > 0)
+    qsort(file->chunk_map, num_chunks, sizeof(*file->chunk_map),
+          compare_chunks);
+    }
+
+  /* Chunk sizes: Distance to the next chunk with a larger offset.
+     Last chunk: Take the end of the mdat atom */
+
+  next_offset = file->mdat.atom.start + file->mdat.atom.size;
+  
+  for(j = num_chunks - 1; j >= 0; j--)
+    {
+    if((j < num_chunks - 1) &&
+       (file->chunk_map[j+1].offset > file->chunk_map[j].offset))
+      next_offset = file->chunk_map[j+1].offset;
+    
+    file->chunk_map[j].size = next_offset - file->chunk_map[j].offset;
+    if(file->chunk_map[j].size < 0)
+      file->chunk_map[j].size = 0;
+
+    /* AVI files have exact chunk sizes in the index */
+    trak = file->moov.trak[file->chunk_map[j].trak];
+    if(file->fragment && trak->chunk_sizes)
       {
-      ret[i] = next_offset - trak->mdia.minf.stbl.stco.table[i].offset;
+      /* Fragmented files have them from the trun atoms */
+      if(file->chunk_map[j].chunk < trak->chunk_sizes_alloc)
+        file->chunk_map[j].size = trak->chunk_sizes[file->chunk_map[j].chunk];
       }
-    else /* Last chunk: Take the end of the mdat atom */
+    else if(file->file_type & (LQT_FILE_AVI|LQT_FILE_AVI_ODML))
       {
-      ret[i] = file->mdat.atom.start + file->mdat.atom.size -
-        trak->mdia.minf.stbl.stco.table[i].offset;
-      if(ret[i] < 0)
-        ret[i] = 0;
+      if(trak->chunk_sizes)
+        {
+        if(file->chunk_map[j].chunk < trak->chunk_sizes_alloc)
+          file->chunk_map[j].size = trak->chunk_sizes[file->chunk_map[j].chunk];
+        }
+      else
+        {
+        first = quicktime_sample_of_chunk(trak, file->chunk_map[j].chunk + 1);
+        file->chunk_map[j].size =
+          quicktime_sample_range_size(trak, first,
+                                      first + quicktime_chunk_samples(trak, file->chunk_map[j].chunk));
+        }
       }
     }
-  free(chunk_indices);
+  return 1;
+  }
+
+#undef HEAP_OFFSET
+#undef HEAP_LESS
+
+int64_t * lqt_get_chunk_sizes(quicktime_t * file, quicktime_trak_t *trak)
+  {
+  long i;
+  int index;
+  int64_t * ret;
+  long num_chunks;
+  
+  num_chunks = trak->mdia.minf.stbl.stco.total_entries;
+  ret = calloc(num_chunks, sizeof(int64_t));
+
+  if(!quicktime_build_chunk_map(file))
+    return ret;
+
+  for(index = 0; index < file->moov.total_tracks; index++)
+    {
+    if(file->moov.trak[index] == trak)
+      break;
+    }
+  
+  for(i = 0; i < file->chunk_map_size; i++)
+    {
+    if(file->chunk_map[i].trak == index)
+      ret[file->chunk_map[i].chunk] = file->chunk_map[i].size;
+    }
   return ret;
   }
 
+long lqt_get_num_chunks(quicktime_t * file)
+  {
+  if(!quicktime_build_chunk_map(file))
+    return 0;
+  return file->chunk_map_size;
+  }
+
+int lqt_get_chunk_info(quicktime_t * file, long index, lqt_chunk_info_t * info)
+  {
+  int i;
+  quicktime_trak_t * trak;
+  
+  if(!quicktime_build_chunk_map(file) ||
+     (index < 0) || (index >= file->chunk_map_size))
+    return 0;
+  
+  info->offset = file->chunk_map[index].offset;
+  info->size   = file->chunk_map[index].size;
+  info->chunk  = file->chunk_map[index].chunk;
+  info->type   = LQT_TRACK_NONE;
+  info->track  = -1;
+
+  trak = file->moov.trak[file->chunk_map[index].trak];
+
+  for(i = 0; i < file->total_atracks; i++)
+    {
+    if(file->atracks[i].track == trak)
+      {
+      info->type = LQT_TRACK_AUDIO;
+      info->track = i;
+      return 1;
+      }
+    }
+  for(i = 0; i < file->total_vtracks; i++)
+    {
+    if(file->vtracks[i].track == trak)
+      {
+      info->type = LQT_TRACK_VIDEO;
+      info->track = i;
+      return 1;
+      }
+    }
+  for(i = 0; i < file->total_ttracks; i++)
+    {
+    if(file->ttracks[i].track == trak)
+      {
+      info->type = LQT_TRACK_TEXT;
+      info->track = i;
+      return 1;
+      }
+    }
+  return 1;
+  }
+
 int lqt_read_audio_chunk(quicktime_t * file, int track,
                          long chunk,
                          uint8_t ** buffer, int * buffer_alloc, int * samples)
@@ -2403,9 +3183,59 @@ int lqt_read_audio_chunk(quicktime_t * file, int track,
 
   memset((*buffer) + trak->chunk_sizes[chunk], 0, 16);
   
+  if(file->readahead)
+    quicktime_readahead_audio(file, track, chunk);
+
   return result ? trak->chunk_sizes[chunk] : 0;
   }
 
+int lqt_peek_audio_chunk(quicktime_t * file, int track,
+                         long chunk,
+                         const uint8_t ** data, int * len, int * samples)
+  {
+  quicktime_trak_t * trak;
+  quicktime_audio_map_t * atrack;
+
+  if((track >= file->total_atracks) || (track < 0))
+    return 0;
+
+  atrack = &file->atracks[track];
+  trak = atrack->track;
+
+  if(chunk >= trak->mdia.minf.stbl.stco.total_entries)
+    {
+    /* Read beyond EOF */
+    atrack->eof = 1;
+    return 0;
+    }
+  if(!trak->chunk_sizes)
+    {
+    trak->chunk_sizes = lqt_get_chunk_sizes(file, trak);
+    }
+  if(samples)
+    *samples = quicktime_chunk_samples(trak, chunk);
+
+  *len = trak->chunk_sizes[chunk];
+
+  quicktime_set_position(file, quicktime_chunk_to_offset(file, trak, chunk));
+  
+  /* Zero copy if the chunk is inside the mapping */
+  if((*data = quicktime_peek_data(file, *len)))
+    {
+    if(file->readahead)
+      quicktime_readahead_audio(file, track, chunk);
+    return 1;
+    }
+
+  /* Copy into our own buffer */
+  if(!lqt_read_audio_chunk(file, track, chunk, &atrack->peek_buffer,
+                           &atrack->peek_buffer_alloc, NULL) && *len)
+    return 0;
+
+  *data = atrack->peek_buffer;
+  return 1;
+  }
+
 int lqt_append_audio_chunk(quicktime_t * file, int track,
                            long chunk,
                            uint8_t ** buffer, int * buffer_alloc,
@@ -2447,6 +3277,9 @@ int lqt_append_audio_chunk(quicktime_t * file, int track,
 
   memset((*buffer) + initial_bytes + trak->chunk_sizes[chunk], 0, 16);
   
+  if(file->readahead)
+    quicktime_readahead_audio(file, track, chunk);
+
   return result ? trak->chunk_sizes[chunk] : 0;
   }
 
@@ -2648,7 +3481,7 @@ void lqt_finish_audio_vbr_frame(quicktime_t * file, int track, int num_samples)
   stsz = &atrack->track->mdia.minf.stbl.stsz;
   stts = &atrack->track->mdia.minf.stbl.stts;
 
-  vbr_frames_written = stsz->total_entries;
+  vbr_frames_written = stsz->total_entries + stsz->index_base;
   
   /* Update stsz */
 
@@ -2900,7 +3733,8 @@ filetypes[] =
       { LQT_FILE_AVI_ODML, "AVI ODML"          },
       { LQT_FILE_MP4,      "MP4"               },
       { LQT_FILE_M4A,      "M4A"               },
-      { LQT_FILE_3GP,      "3GP"               }
+      { LQT_FILE_3GP,      "3GP"               },
+      { LQT_FILE_MP4_FRAGMENTED, "Fragmented MP4" }
   };
   
 const char * lqt_file_type_to_string(lqt_file_type_t type)
@@ -0,0 +1,307 @@
+/*******************************************************************************
+ lqt_readahead.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Background read ahead.
+ *
+ *  Since the sample tables tell us exactly, which bytes will be read next,
+ *  the reading functions pass the ranges of the next frames (or chunks)
+ *  to a worker thread. The worker reads them into a scratch buffer
+ *  (or touches the pages of the memory mapping), so they are in the
+ *  page cache when the decoder asks for them. The normal read path
+ *  is not changed at all.
+ */
+
+#include "lqt_private.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LOG_DOMAIN "readahead"
+
+/* Maximum number of pending ranges. If the queue is full, new
+   requests are dropped (they are only hints anyway) */
+#define QUEUE_SIZE 256
+
+/* Read in pieces of this size */
+#define READ_SIZE (256*1024)
+
+typedef struct
+  {
+  int64_t offset;
+  int64_t size;
+  } range_t;
+
+struct quicktime_readahead_s
+  {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  range_t queue[QUEUE_SIZE];
+  int queue_start;
+  int queue_len;
+
+  int quit;
+  int frames;
+
+  int fd;
+  const uint8_t * mmap_buffer;
+  int64_t mmap_size;
+  uint8_t * buffer;
+  };
+
+static void do_range(quicktime_readahead_t * ra, range_t * r)
+  {
+  int64_t pos, end;
+  ssize_t result;
+  long page_size;
+  volatile uint8_t dummy;
+
+  end = r->offset + r->size;
+
+  if(ra->mmap_buffer)
+    {
+    /* Touch each page to fault it in */
+    page_size = sysconf(_SC_PAGESIZE);
+    if(page_size <= 0)
+      page_size = 4096;
+
+    if(end > ra->mmap_size)
+      end = ra->mmap_size;
+    for(pos = r->offset; pos < end; pos += page_size)
+      dummy = ra->mmap_buffer[pos];
+    if(end > r->offset)
+      dummy = ra->mmap_buffer[end-1];
+    (void)dummy;
+    return;
+    }
+
+  pos = r->offset;
+  while(pos < end)
+    {
+    result = pread(ra->fd, ra->buffer,
+                   (end - pos > READ_SIZE) ? READ_SIZE : end - pos, pos);
+    if(result <= 0)
+      break;
+    pos += result;
+    }
+  }
+
+static void * thread_func(void * data)
+  {
+  quicktime_readahead_t * ra = data;
+  range_t r;
+
+  pthread_mutex_lock(&ra->mutex);
+
+  while(1)
+    {
+    while(!ra->queue_len && !ra->quit)
+      pthread_cond_wait(&ra->cond, &ra->mutex);
+
+    if(ra->quit)
+      break;
+
+    r = ra->queue[ra->queue_start];
+    ra->queue_start = (ra->queue_start + 1) % QUEUE_SIZE;
+    ra->queue_len--;
+
+    pthread_mutex_unlock(&ra->mutex);
+    do_range(ra, &r);
+    pthread_mutex_lock(&ra->mutex);
+    }
+
+  pthread_mutex_unlock(&ra->mutex);
+  return NULL;
+  }
+
+void quicktime_readahead_stop(quicktime_t * file)
+  {
+  quicktime_readahead_t * ra = file->readahead;
+
+  if(!ra)
+    return;
+
+  pthread_mutex_lock(&ra->mutex);
+  ra->quit = 1;
+  pthread_cond_signal(&ra->cond);
+  pthread_mutex_unlock(&ra->mutex);
+
+  pthread_join(ra->thread, NULL);
+
+  pthread_mutex_destroy(&ra->mutex);
+  pthread_cond_destroy(&ra->cond);
+  if(ra->buffer)
+    free(ra->buffer);
+  free(ra);
+  file->readahead = NULL;
+  }
+
+void lqt_set_readahead(quicktime_t * file, int frames)
+  {
+  quicktime_readahead_t * ra;
+  int i;
+
+  if(frames <= 0)
+    {
+    quicktime_readahead_stop(file);
+    return;
+    }
+
+  if(file->readahead)
+    {
+    file->readahead->frames = frames;
+    return;
+    }
+
+  if(!file->rd || file->wr || !file->stream)
+    return;
+
+  ra = calloc(1, sizeof(*ra));
+  ra->frames = frames;
+  ra->mmap_buffer = file->mmap_buffer;
+  ra->mmap_size = file->mmap_size;
+  ra->fd = fileno(file->stream);
+
+  if(!ra->mmap_buffer)
+    ra->buffer = malloc(READ_SIZE);
+
+  pthread_mutex_init(&ra->mutex, NULL);
+  pthread_cond_init(&ra->cond, NULL);
+
+  if(pthread_create(&ra->thread, NULL, thread_func, ra))
+    {
+    lqt_log(file, LQT_LOG_ERROR, LOG_DOMAIN, "Cannot create thread");
+    pthread_mutex_destroy(&ra->mutex);
+    pthread_cond_destroy(&ra->cond);
+    if(ra->buffer)
+      free(ra->buffer);
+    free(ra);
+    return;
+    }
+  file->readahead = ra;
+
+  /* Start from the current positions */
+  for(i = 0; i < file->total_vtracks; i++)
+    file->vtracks[i].readahead_pos = -1;
+  for(i = 0; i < file->total_atracks; i++)
+    file->atracks[i].readahead_pos = -1;
+  }
+
+/* Queue ranges. Adjacent ranges are merged */
+
+static void queue_range(quicktime_readahead_t * ra,
+                        int64_t offset, int64_t size)
+  {
+  range_t * last;
+
+  if(size <= 0)
+    return;
+
+  if(ra->queue_len)
+    {
+    last = &ra->queue[(ra->queue_start + ra->queue_len - 1) % QUEUE_SIZE];
+    if(last->offset + last->size == offset)
+      {
+      last->size += size;
+      return;
+      }
+    }
+  if(ra->queue_len == QUEUE_SIZE)
+    return;
+
+  last = &ra->queue[(ra->queue_start + ra->queue_len) % QUEUE_SIZE];
+  last->offset = offset;
+  last->size = size;
+  ra->queue_len++;
+  }
+
+/* Called after reading a frame: Queue the frames, which
+   weren't requested yet */
+
+void quicktime_readahead_video(quicktime_t * file, int track, int64_t frame)
+  {
+  quicktime_readahead_t * ra = file->readahead;
+  quicktime_video_map_t * vtrack = &file->vtracks[track];
+  int64_t end, total;
+
+  total = quicktime_track_samples(file, vtrack->track);
+  end = frame + 1 + ra->frames;
+  if(end > total)
+    end = total;
+
+  /* Seeked */
+  if((vtrack->readahead_pos <= frame) || (vtrack->readahead_pos > end))
+    vtrack->readahead_pos = frame + 1;
+
+  if(vtrack->readahead_pos >= end)
+    return;
+
+  pthread_mutex_lock(&ra->mutex);
+  while(vtrack->readahead_pos < end)
+    {
+    queue_range(ra,
+                quicktime_sample_to_offset(file, vtrack->track,
+                                           vtrack->readahead_pos),
+                quicktime_frame_size(file, vtrack->readahead_pos, track));
+    vtrack->readahead_pos++;
+    }
+  pthread_cond_signal(&ra->cond);
+  pthread_mutex_unlock(&ra->mutex);
+  }
+
+/* Same for audio chunks */
+
+void quicktime_readahead_audio(quicktime_t * file, int track, int64_t chunk)
+  {
+  quicktime_readahead_t * ra = file->readahead;
+  quicktime_audio_map_t * atrack = &file->atracks[track];
+  quicktime_trak_t * trak = atrack->track;
+  int64_t end;
+
+  if(!trak->chunk_sizes)
+    return;
+
+  end = chunk + 1 + ra->frames;
+  if(end > trak->mdia.minf.stbl.stco.total_entries)
+    end = trak->mdia.minf.stbl.stco.total_entries;
+
+  if((atrack->readahead_pos <= chunk) || (atrack->readahead_pos > end))
+    atrack->readahead_pos = chunk + 1;
+
+  if(atrack->readahead_pos >= end)
+    return;
+
+  pthread_mutex_lock(&ra->mutex);
+  while(atrack->readahead_pos < end)
+    {
+    queue_range(ra,
+                quicktime_chunk_to_offset(file, trak, atrack->readahead_pos),
+                trak->chunk_sizes[atrack->readahead_pos]);
+    atrack->readahead_pos++;
+    }
+  pthread_cond_signal(&ra->cond);
+  pthread_mutex_unlock(&ra->mutex);
+  }
@@ -0,0 +1,202 @@
+/*******************************************************************************
+ lqt_threads.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Thread pool for splitting work into independent jobs.
+ *
+ *  quicktime_thread_pool_run() hands out the jobs to the worker threads
+ *  and works on them in the calling thread as well. It returns when
+ *  all jobs are done, so the caller doesn't need any synchronization.
+ */
+
+#include "lqt_private.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define LOG_DOMAIN "threads"
+
+struct quicktime_thread_pool_s
+  {
+  pthread_t * threads;
+  int num_threads;
+  int requested_threads; /* Can be more than num_threads if creating failed */
+
+  pthread_mutex_t mutex;
+  pthread_cond_t start_cond;  /* Signals the workers */
+  pthread_cond_t done_cond;   /* Signals the caller */
+
+  void (*func)(void * data, int job, int num_jobs);
+  void * data;
+
+  int num_jobs;
+  int next_job;
+  int jobs_done;
+
+  int quit;
+  };
+
+/* Work on jobs until none is left. Called with the mutex locked */
+
+static void do_jobs(quicktime_thread_pool_t * p)
+  {
+  int job;
+
+  while(p->next_job < p->num_jobs)
+    {
+    job = p->next_job++;
+    pthread_mutex_unlock(&p->mutex);
+
+    p->func(p->data, job, p->num_jobs);
+
+    pthread_mutex_lock(&p->mutex);
+    p->jobs_done++;
+    if(p->jobs_done == p->num_jobs)
+      pthread_cond_signal(&p->done_cond);
+    }
+  }
+
+static void * thread_func(void * data)
+  {
+  quicktime_thread_pool_t * p = data;
+
+  pthread_mutex_lock(&p->mutex);
+
+  while(1)
+    {
+    while(!p->quit && (p->next_job >= p->num_jobs))
+      pthread_cond_wait(&p->start_cond, &p->mutex);
+
+    if(p->quit)
+      break;
+
+    do_jobs(p);
+    }
+
+  pthread_mutex_unlock(&p->mutex);
+  return NULL;
+  }
+
+quicktime_thread_pool_t * quicktime_thread_pool_create(quicktime_t * file,
+                                                       int num_threads)
+  {
+  quicktime_thread_pool_t * p;
+  int i;
+
+  p = calloc(1, sizeof(*p));
+  p->requested_threads = num_threads;
+
+  pthread_mutex_init(&p->mutex, NULL);
+  pthread_cond_init(&p->start_cond, NULL);
+  pthread_cond_init(&p->done_cond, NULL);
+
+  /* The calling thread is one of them */
+  p->threads = calloc(num_threads - 1, sizeof(*p->threads));
+
+  for(i = 0; i < num_threads - 1; i++)
+    {
+    if(pthread_create(&p->threads[i], NULL, thread_func, p))
+      {
+      lqt_log(file, LQT_LOG_ERROR, LOG_DOMAIN, "Cannot create thread");
+      break;
+      }
+    p->num_threads++;
+    }
+
+  if(!p->num_threads)
+    {
+    quicktime_thread_pool_destroy(p);
+    return NULL;
+    }
+
+  p->num_threads++;
+  return p;
+  }
+
+void quicktime_thread_pool_destroy(quicktime_thread_pool_t * p)
+  {
+  int i;
+
+  pthread_mutex_lock(&p->mutex);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start_cond);
+  pthread_mutex_unlock(&p->mutex);
+
+  /* num_threads includes the calling thread if threads were started */
+  for(i = 0; i < p->num_threads - 1; i++)
+    pthread_join(p->threads[i], NULL);
+
+  pthread_mutex_destroy(&p->mutex);
+  pthread_cond_destroy(&p->start_cond);
+  pthread_cond_destroy(&p->done_cond);
+  free(p->threads);
+  free(p);
+  }
+
+int quicktime_thread_pool_threads(quicktime_thread_pool_t * p)
+  {
+  return p->num_threads;
+  }
+
+void quicktime_thread_pool_run(quicktime_thread_pool_t * p,
+                               void (*func)(void * data, int job, int num_jobs),
+                               void * data, int num_jobs)
+  {
+  pthread_mutex_lock(&p->mutex);
+
+  p->func = func;
+  p->data = data;
+  p->jobs_done = 0;
+  p->next_job = 0;
+  p->num_jobs = num_jobs;
+  pthread_cond_broadcast(&p->start_cond);
+
+  do_jobs(p);
+
+  while(p->jobs_done < p->num_jobs)
+    pthread_cond_wait(&p->done_cond, &p->mutex);
+
+  pthread_mutex_unlock(&p->mutex);
+  }
+
+void lqt_set_video_threads(quicktime_t * file, int track, int threads)
+  {
+  quicktime_video_map_t * vtrack;
+
+  if((track < 0) || (track >= file->total_vtracks))
+    return;
+
+  vtrack = &file->vtracks[track];
+
+  if(vtrack->thread_pool)
+    {
+    if((threads > 1) &&
+       (vtrack->thread_pool->requested_threads == threads))
+      return;
+    quicktime_thread_pool_destroy(vtrack->thread_pool);
+    vtrack->thread_pool = NULL;
+    }
+
+  if(threads > 1)
+    vtrack->thread_pool = quicktime_thread_pool_create(file, threads);
+  }
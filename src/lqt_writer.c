@@ -0,0 +1,255 @@
+/*******************************************************************************
+ lqt_writer.c
+
+ libquicktime - A library for reading and writing quicktime/avi/mp4 files.
+ http://libquicktime.sourceforge.net
+
+ Copyright (C) 2002 Heroine Virtual Ltd.
+ Copyright (C) 2002-2011 Members of the libquicktime project.
+
+ This library is free software; you can redistribute it and/or modify it under
+ the terms of the GNU Lesser General Public License as published by the Free
+ Software Foundation; either version 2.1 of the License, or (at your option)
+ any later version.
+
+ This library is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ details.
+
+ You should have received a copy of the GNU Lesser General Public License along
+ with this library; if not, write to the Free Software Foundation, Inc., 51
+ Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*******************************************************************************/
+
+/*
+ *  Asynchronous writing.
+ *
+ *  The presave buffer becomes one of a ring of blocks. Full blocks are
+ *  queued and written by a background thread, while the encoder continues
+ *  in the next free block. If no block is free, the encoder waits
+ *  (back pressure). Write errors of the thread are passed to
+ *  file->io_error with the next submitted block.
+ */
+
+#include "lqt_private.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define LOG_DOMAIN "writer"
+
+typedef struct
+  {
+  uint8_t * data;
+  int64_t offset;
+  int64_t size;
+  } block_t;
+
+struct quicktime_writer_s
+  {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t queue_cond;  /* Signals the thread */
+  pthread_cond_t free_cond;   /* Signals the encoder */
+
+  block_t * blocks;
+  int num_blocks;
+
+  /* Queued blocks (in order) */
+  int * queue;
+  int queue_start;
+  int queue_len;
+
+  /* Free blocks */
+  int * free_blocks;
+  int num_free;
+
+  /* Block, which is the presave buffer right now */
+  int current;
+
+  /* Block being written by the thread */
+  int busy;
+
+  int error;
+  int quit;
+  };
+
+static void * thread_func(void * data)
+  {
+  quicktime_t * file = data;
+  quicktime_writer_t * w = file->writer;
+  block_t * b;
+  int index, error;
+
+  pthread_mutex_lock(&w->mutex);
+
+  while(1)
+    {
+    while(!w->queue_len && !w->quit)
+      pthread_cond_wait(&w->queue_cond, &w->mutex);
+
+    if(!w->queue_len)
+      break;
+
+    index = w->queue[w->queue_start];
+    w->queue_start = (w->queue_start + 1) % w->num_blocks;
+    w->queue_len--;
+    w->busy = 1;
+    error = w->error;
+    pthread_mutex_unlock(&w->mutex);
+
+    b = &w->blocks[index];
+
+    /* Don't write after errors, to keep the order of the data intact */
+    if(!error &&
+       (quicktime_write_block(file, b->offset, b->data, b->size) < b->size))
+      error = 1;
+
+    pthread_mutex_lock(&w->mutex);
+    w->error = error;
+    w->busy = 0;
+    w->free_blocks[w->num_free++] = index;
+    pthread_cond_broadcast(&w->free_cond);
+    }
+
+  pthread_mutex_unlock(&w->mutex);
+  return NULL;
+  }
+
+void lqt_set_async_write(quicktime_t * file, int blocks)
+  {
+  quicktime_writer_t * w;
+  int i;
+
+  if(blocks < 2)
+    {
+    quicktime_writer_stop(file);
+    return;
+    }
+
+  if(!file->wr || file->writer)
+    return;
+
+  w = calloc(1, sizeof(*w));
+  w->num_blocks = blocks;
+  w->blocks = calloc(blocks, sizeof(*w->blocks));
+  w->queue = calloc(blocks, sizeof(*w->queue));
+  w->free_blocks = calloc(blocks, sizeof(*w->free_blocks));
+
+  /* The current presave buffer becomes the first block */
+  w->blocks[0].data = file->presave_buffer;
+  w->current = 0;
+
+  for(i = 1; i < blocks; i++)
+    {
+    w->blocks[i].data = malloc(QUICKTIME_PRESAVE);
+    w->free_blocks[w->num_free++] = i;
+    }
+
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->queue_cond, NULL);
+  pthread_cond_init(&w->free_cond, NULL);
+
+  file->writer = w;
+
+  if(pthread_create(&w->thread, NULL, thread_func, file))
+    {
+    lqt_log(file, LQT_LOG_ERROR, LOG_DOMAIN, "Cannot create thread");
+    file->writer = NULL;
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->queue_cond);
+    pthread_cond_destroy(&w->free_cond);
+    for(i = 1; i < blocks; i++)
+      free(w->blocks[i].data);
+    free(w->blocks);
+    free(w->queue);
+    free(w->free_blocks);
+    free(w);
+    }
+  }
+
+/* Queue the presave buffer and switch to a free block. Return 0 if
+   an error occurred before. */
+
+int quicktime_writer_submit(quicktime_t * file)
+  {
+  quicktime_writer_t * w = file->writer;
+  block_t * b;
+  int ret;
+
+  pthread_mutex_lock(&w->mutex);
+
+  b = &w->blocks[w->current];
+  b->offset = file->presave_position - file->presave_size;
+  b->size = file->presave_size;
+
+  w->queue[(w->queue_start + w->queue_len) % w->num_blocks] = w->current;
+  w->queue_len++;
+  pthread_cond_signal(&w->queue_cond);
+
+  /* Back pressure */
+  while(!w->num_free)
+    pthread_cond_wait(&w->free_cond, &w->mutex);
+
+  w->current = w->free_blocks[--w->num_free];
+  ret = !w->error;
+  pthread_mutex_unlock(&w->mutex);
+
+  file->presave_buffer = w->blocks[w->current].data;
+  file->presave_size = 0;
+
+  if(!ret && !file->io_error)
+    file->io_error = 1;
+  return ret;
+  }
+
+/* Wait until all queued blocks are written */
+
+void quicktime_writer_sync(quicktime_t * file)
+  {
+  quicktime_writer_t * w = file->writer;
+
+  pthread_mutex_lock(&w->mutex);
+  while(w->queue_len || w->busy)
+    pthread_cond_wait(&w->free_cond, &w->mutex);
+  if(w->error && !file->io_error)
+    file->io_error = 1;
+  pthread_mutex_unlock(&w->mutex);
+  }
+
+/* Write all queued blocks and stop the thread. The presave
+   buffer stays valid. */
+
+void quicktime_writer_stop(quicktime_t * file)
+  {
+  quicktime_writer_t * w = file->writer;
+  int i;
+
+  if(!w)
+    return;
+
+  pthread_mutex_lock(&w->mutex);
+  w->quit = 1;
+  pthread_cond_signal(&w->queue_cond);
+  pthread_mutex_unlock(&w->mutex);
+
+  pthread_join(w->thread, NULL);
+
+  if(w->error && !file->io_error)
+    file->io_error = 1;
+
+  for(i = 0; i < w->num_blocks; i++)
+    {
+    if(i != w->current)
+      free(w->blocks[i].data);
+    }
+
+  pthread_mutex_destroy(&w->mutex);
+  pthread_cond_destroy(&w->queue_cond);
+  pthread_cond_destroy(&w->free_cond);
+  free(w->blocks);
+  free(w->queue);
+  free(w->free_blocks);
+  free(w);
+  file->writer = NULL;
+  }
@@ -240,6 +240,12 @@ int quicktime_read_moov(quicktime_t *file, quicktime_moov_t *moov, quicktime_ato
                         moov->has_iods = 1;
 		}
 		else
+		if(quicktime_atom_is(&leaf_atom, "mvex"))
+		{
+                        quicktime_fragment_read_mvex(file, &leaf_atom);
+			quicktime_atom_skip(file, &leaf_atom);
+		}
+		else
 		quicktime_atom_skip(file, &leaf_atom);
 	}while(quicktime_position(file) < parent_atom->end);
 	
@@ -297,6 +303,8 @@ void quicktime_write_moov(quicktime_t *file, quicktime_moov_t *moov)
           {
           quicktime_write_trak(file, moov->trak[i]);
           }
+	if(file->fragment)
+		quicktime_fragment_write_mvex(file);
 	quicktime_write_udta(file, &moov->udta);
 	/*quicktime_write_ctab(file, &moov->ctab); */
 
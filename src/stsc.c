@@ -66,6 +66,8 @@ void quicktime_stsc_init_audio(quicktime_t *file, quicktime_stsc_t *stsc, int sa
 void quicktime_stsc_delete(quicktime_stsc_t *stsc)
 {
 	if(stsc->total_entries) free(stsc->table);
+	if(stsc->sample_index) free(stsc->sample_index);
+	stsc->sample_index = NULL;
 	stsc->total_entries = 0;
 }
 
@@ -128,6 +130,61 @@ void quicktime_compress_stsc(quicktime_stsc_t *stsc)
   stsc->total_entries = last_same;
   }
 
+/* Build the sample index for reading. If the table is broken (chunk
+   numbers not increasing), no index is built and the lookups in trak.c
+   fall back to linear searches */
+
+void quicktime_stsc_build_index(quicktime_stsc_t *stsc)
+  {
+  long i;
+
+  if(stsc->sample_index)
+    {
+    free(stsc->sample_index);
+    stsc->sample_index = NULL;
+    }
+
+  if(!stsc->total_entries)
+    return;
+
+  for(i = 1; i < stsc->total_entries; i++)
+    {
+    if(stsc->table[i].chunk < stsc->table[i-1].chunk)
+      return;
+    }
+  
+  stsc->sample_index = malloc(stsc->total_entries * sizeof(*stsc->sample_index));
+  stsc->sample_index[0] = 0;
+
+  for(i = 1; i < stsc->total_entries; i++)
+    {
+    stsc->sample_index[i] = stsc->sample_index[i-1] +
+      (int64_t)(stsc->table[i].chunk - stsc->table[i-1].chunk) *
+      stsc->table[i-1].samples;
+    }
+  }
+
+/* Return the last entry whose first chunk (starting with 1) is
+   <= chunk or -1 if there is no such entry */
+
+long quicktime_stsc_find_chunk(quicktime_stsc_t *stsc, long chunk)
+  {
+  long lo = 0, hi = stsc->total_entries - 1, mid;
+
+  if(!stsc->total_entries || (stsc->table[0].chunk > chunk))
+    return -1;
+
+  while(lo < hi)
+    {
+    mid = lo + (hi - lo + 1) / 2;
+    if(stsc->table[mid].chunk <= chunk)
+      lo = mid;
+    else
+      hi = mid - 1;
+    }
+  return lo;
+  }
+
 void quicktime_write_stsc(quicktime_t *file, quicktime_stsc_t *stsc)
   {
   int i;
@@ -148,27 +205,37 @@ void quicktime_write_stsc(quicktime_t *file, quicktime_stsc_t *stsc)
   quicktime_atom_write_footer(file, &atom);
   }
 
+/* Entries are only added if the number of samples per chunk changes.
+   The last chunk can be updated again. */
+
 int quicktime_update_stsc(quicktime_stsc_t *stsc, long chunk, long samples)
   {
+  quicktime_stsc_table_t * last;
+  
   chunk++;
-  if(chunk > stsc->entries_allocated)
+  last = stsc->total_entries ? &stsc->table[stsc->total_entries - 1] : NULL;
+
+  /* Last chunk (or the dummy entry from quicktime_stsc_init_table())
+     gets updated */
+  if(last && (last->chunk == chunk))
     {
-    stsc->entries_allocated = chunk * 2;
-    stsc->table =(quicktime_stsc_table_t*)realloc(stsc->table, sizeof(quicktime_stsc_table_t) * stsc->entries_allocated);
+    last->samples = samples;
+    if((stsc->total_entries > 1) && (last[-1].samples == samples))
+      stsc->total_entries--;
+    return 0;
     }
 
-  stsc->table[chunk - 1].samples = samples;
-  stsc->table[chunk - 1].chunk = chunk;
-  stsc->table[chunk - 1].id = 1;
-  if(chunk > stsc->total_entries) stsc->total_entries = chunk;
+  if(last && (last->samples == samples))
+    return 0;
+  
+  if(stsc->total_entries >= stsc->entries_allocated)
+    {
+    stsc->entries_allocated = stsc->entries_allocated * 2 + 16;
+    stsc->table = realloc(stsc->table, sizeof(*stsc->table) * stsc->entries_allocated);
+    }
+  last = &stsc->table[stsc->total_entries++];
+  last->chunk = chunk;
+  last->samples = samples;
+  last->id = 1;
   return 0;
   }
-
-/* Optimizing while writing doesn't allow seeks during recording so */
-/* entries are created for every chunk and only optimized during */
-/* writeout.  Unfortunately there's no way to keep audio synchronized */
-/* after overwriting  a recording as the fractional audio chunk in the */
-/* middle always overwrites the previous location of a larger chunk.  On */
-/* writing, the table must be optimized.  RealProducer requires an  */
-/* optimized table. */
-
@@ -32,11 +32,18 @@ void quicktime_stss_init(quicktime_stss_t *stss)
   stss->total_entries = 0;
   stss->entries_allocated = 0;
   stss->table = NULL;
+  stss->sorted = 1;
+  stss->bitmap = NULL;
+  stss->bitmap_samples = 0;
   }
 
 void quicktime_stss_delete(quicktime_stss_t *stss)
   {
   if(stss->table) free(stss->table);
+  if(stss->bitmap) free(stss->bitmap);
+  stss->bitmap = NULL;
+  stss->bitmap_samples = 0;
+  stss->sorted = 1;
   stss->total_entries = 0;
   stss->entries_allocated = 0;
   stss->table = 0;
@@ -68,12 +75,117 @@ void quicktime_read_stss(quicktime_t *file, quicktime_stss_t *stss)
     stss->table = (quicktime_stss_table_t*)realloc(stss->table, sizeof(quicktime_stss_table_t) * stss->entries_allocated);
     }
 
+  stss->sorted = 1;
   for(i = 0; i < stss->total_entries; i++)
     {
     stss->table[i].sample = quicktime_read_int32(file);
+    if(i && (stss->table[i].sample <= stss->table[i-1].sample))
+      stss->sorted = 0;
     }
   }
 
+/* Build a bitmap of the sync samples. Samples after the last
+   table entry are never keyframes, so the bitmap ends there.
+   The table isn't trusted, so the bitmap never gets larger than
+   total_samples (the number of samples in stsz). */
+
+void quicktime_stss_build_index(quicktime_stss_t *stss, long total_samples)
+  {
+  long i, sample;
+
+  if(stss->bitmap)
+    {
+    free(stss->bitmap);
+    stss->bitmap = NULL;
+    stss->bitmap_samples = 0;
+    }
+
+  if(!stss->total_entries || !stss->sorted ||
+     (stss->table[0].sample < 1) || (total_samples < 1))
+    return;
+
+  stss->bitmap_samples = stss->table[stss->total_entries-1].sample;
+  if(stss->bitmap_samples > total_samples)
+    stss->bitmap_samples = total_samples;
+
+  /* Fall back to searching the table */
+  if(!(stss->bitmap = calloc((stss->bitmap_samples + 7) / 8, 1)))
+    {
+    stss->bitmap_samples = 0;
+    return;
+    }
+
+  for(i = 0; i < stss->total_entries; i++)
+    {
+    sample = stss->table[i].sample - 1;
+    if(sample >= stss->bitmap_samples)
+      break;
+    stss->bitmap[sample >> 3] |= 1 << (sample & 7);
+    }
+  }
+
+/* Return the index of the last table entry with a sample number
+   less than or equal to sample (1-based), or -1 if there is none */
+
+long quicktime_stss_find(quicktime_stss_t *stss, long sample)
+  {
+  long lo, hi, mid, i;
+
+  if(!stss->sorted)
+    {
+    long ret = -1;
+    /* Pick the largest matching entry */
+    for(i = 0; i < stss->total_entries; i++)
+      {
+      if((stss->table[i].sample <= sample) &&
+         ((ret < 0) || (stss->table[i].sample > stss->table[ret].sample)))
+        ret = i;
+      }
+    return ret;
+    }
+
+  lo = 0;
+  hi = stss->total_entries;
+
+  while(lo < hi)
+    {
+    mid = lo + (hi - lo) / 2;
+    if(stss->table[mid].sample <= sample)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo - 1;
+  }
+
+/* Check if a sample (1-based) is a sync sample */
+
+int quicktime_stss_is_sync(quicktime_stss_t *stss, long sample)
+  {
+  long i;
+
+  if(stss->bitmap)
+    {
+    if((sample < 1) || (sample > stss->bitmap_samples))
+      return 0;
+    sample--;
+    return !!(stss->bitmap[sample >> 3] & (1 << (sample & 7)));
+    }
+
+  if(!stss->sorted)
+    {
+    for(i = 0; i < stss->total_entries; i++)
+      {
+      if(stss->table[i].sample == sample)
+        return 1;
+      }
+    return 0;
+    }
+
+  i = quicktime_stss_find(stss, sample);
+  return (i >= 0) && (stss->table[i].sample == sample);
+  }
+
 
 void quicktime_write_stss(quicktime_t *file, quicktime_stss_t *stss)
   {
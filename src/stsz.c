@@ -77,6 +77,21 @@ void quicktime_stsz_init_audio(quicktime_t *file,
 void quicktime_stsz_delete(quicktime_stsz_t *stsz)
   {
   if(stsz->table) free(stsz->table);
+  if(stsz->size_index) free(stsz->size_index);
+  }
+
+void quicktime_stsz_build_index(quicktime_stsz_t *stsz)
+  {
+  long i;
+
+  if(stsz->size_index)
+    free(stsz->size_index);
+  
+  stsz->size_index = malloc((stsz->total_entries + 1) * sizeof(*stsz->size_index));
+  stsz->size_index[0] = 0;
+  
+  for(i = 0; i < stsz->total_entries; i++)
+    stsz->size_index[i+1] = stsz->size_index[i] + stsz->table[i].size;
   }
 
 void quicktime_stsz_dump(quicktime_stsz_t *stsz)
@@ -168,9 +183,10 @@ void quicktime_update_stsz(quicktime_stsz_t *stsz,
   {
   if(!stsz->sample_size)
     {
+    sample -= stsz->index_base;
     if(sample >= stsz->entries_allocated)
       {
-      stsz->entries_allocated += 1024;
+      stsz->entries_allocated = sample * 2 + 1024;
       stsz->table =
         (quicktime_stsz_table_t*)realloc(stsz->table,
                                          sizeof(quicktime_stsz_table_t) *
@@ -87,8 +87,62 @@ void quicktime_stts_init_timecode(quicktime_t *file, quicktime_stts_t *stts)
 
 void quicktime_stts_delete(quicktime_stts_t *stts)
   {
-  if(stts->total_entries) free(stts->table);
+  if(stts->table) free(stts->table);
+  stts->table = NULL;
   stts->total_entries = 0;
+
+  if(stts->index_samples) free(stts->index_samples);
+  if(stts->index_times) free(stts->index_times);
+  stts->index_samples = NULL;
+  stts->index_times = NULL;
+  }
+
+/* Build the index for reading. Tables with negative durations get
+   no index, the lookups below then fall back to linear searches */
+
+void quicktime_stts_build_index(quicktime_stts_t *stts)
+  {
+  long i;
+
+  for(i = 0; i < stts->total_entries; i++)
+    {
+    if(stts->table[i].sample_duration < 0)
+      return;
+    }
+  
+  stts->index_samples = malloc((stts->total_entries + 1) * sizeof(*stts->index_samples));
+  stts->index_times = malloc((stts->total_entries + 1) * sizeof(*stts->index_times));
+
+  stts->index_samples[0] = 0;
+  stts->index_times[0] = 0;
+
+  for(i = 0; i < stts->total_entries; i++)
+    {
+    stts->index_samples[i+1] = stts->index_samples[i] +
+      stts->table[i].sample_count;
+    stts->index_times[i+1] = stts->index_times[i] +
+      (int64_t)stts->table[i].sample_count * stts->table[i].sample_duration;
+    }
+  }
+
+/* Return the first entry i for which index[i+1] > value
+   (index[i+1] >= value if inclusive is set) or total_entries if there
+   is no such entry. index must have total_entries + 1 nondecreasing values */
+
+int64_t quicktime_stts_find(const int64_t * index, long total_entries,
+                            int64_t value, int inclusive)
+  {
+  long lo = 0, hi = total_entries, mid;
+
+  while(lo < hi)
+    {
+    mid = lo + (hi - lo) / 2;
+    if((index[mid+1] > value) || (inclusive && (index[mid+1] == value)))
+      hi = mid;
+    else
+      lo = mid + 1;
+    }
+  return lo;
   }
 
 void quicktime_stts_dump(quicktime_stts_t *stts)
@@ -144,6 +198,22 @@ int64_t quicktime_time_to_sample(quicktime_stts_t *stts, int64_t * time,
   int64_t ret = 0;
   int64_t time_count = 0;
 
+  if(stts->index_times)
+    {
+    *stts_index = quicktime_stts_find(stts->index_times, stts->total_entries,
+                                      *time, 1);
+    if(*stts_index >= stts->total_entries)
+      {
+      *time = stts->index_times[stts->total_entries];
+      return stts->index_samples[stts->total_entries];
+      }
+    *stts_count = (*time - stts->index_times[*stts_index]) /
+      stts->table[*stts_index].sample_duration;
+    *time = stts->index_times[*stts_index] +
+      *stts_count * stts->table[*stts_index].sample_duration;
+    return stts->index_samples[*stts_index] + *stts_count;
+    }
+  
   *stts_index = 0;
 
   while(1)
@@ -179,6 +249,24 @@ int64_t quicktime_sample_to_time(quicktime_stts_t *stts, int64_t sample,
   int64_t ret = 0;
   int64_t sample_count;
 
+  if(stts->index_times && stts->total_entries)
+    {
+    if(sample < 0)
+      {
+      *stts_index = stts->total_entries;
+      return stts->index_times[stts->total_entries];
+      }
+    *stts_index = quicktime_stts_find(stts->index_samples, stts->total_entries,
+                                      sample, 0);
+    /* Beyond the end: Extrapolate with the last duration */
+    if(*stts_index >= stts->total_entries)
+      *stts_index = stts->total_entries - 1;
+    
+    *stts_count = sample - stts->index_samples[*stts_index];
+    return stts->index_times[*stts_index] +
+      *stts_count * stts->table[*stts_index].sample_duration;
+    }
+  
   if(sample < 0)
     {
     for(*stts_index = 0; *stts_index < stts->total_entries; (*stts_index)++)
@@ -213,25 +301,54 @@ int64_t quicktime_sample_to_time(quicktime_stts_t *stts, int64_t sample,
   return ret;
   }
 
-/* If one calls quicktime_update_stts(), the table is set up with one entry per sample.
-   Before writing, call quicktime_compress_stts() to kick out redundant entries */
+/* quicktime_update_stts() run length encodes the table on the fly.
+   Samples must be appended, only the duration of the last sample can
+   be changed afterwards. */
 
 void quicktime_update_stts(quicktime_stts_t *stts, long sample, long duration)
   {
-  if(sample >= stts->entries_allocated)
+  quicktime_stts_table_t * last;
+  
+  sample -= stts->index_base;
+  if(!duration)
+    duration = stts->default_duration;
+
+  /* Kick out the dummy entry from quicktime_stts_init_table() */
+  if(!stts->num_samples)
+    stts->total_entries = 0;
+  
+  if(sample < stts->num_samples)
     {
-    stts->entries_allocated = sample + 1024;
-    stts->table = realloc(stts->table,
-                          stts->entries_allocated * sizeof(*(stts->table)));
+    if(sample < stts->num_samples - 1)
+      return;
+    
+    /* Remove the last sample */
+    last = &stts->table[stts->total_entries-1];
+    if(last->sample_duration == duration)
+      return;
+    
+    last->sample_count--;
+    if(!last->sample_count)
+      stts->total_entries--;
+    stts->num_samples--;
     }
-  stts->table[sample].sample_count = 1;
-  if(duration)
-    stts->table[sample].sample_duration = duration;
-  else
-    stts->table[sample].sample_duration = stts->default_duration;
   
-  if(sample >= stts->total_entries)
-    stts->total_entries = sample + 1;
+  if(stts->total_entries &&
+     (stts->table[stts->total_entries-1].sample_duration == duration))
+    stts->table[stts->total_entries-1].sample_count++;
+  else
+    {
+    if(stts->total_entries >= stts->entries_allocated)
+      {
+      stts->entries_allocated = stts->entries_allocated * 2 + 16;
+      stts->table = realloc(stts->table,
+                            stts->entries_allocated * sizeof(*(stts->table)));
+      }
+    stts->table[stts->total_entries].sample_count = 1;
+    stts->table[stts->total_entries].sample_duration = duration;
+    stts->total_entries++;
+    }
+  stts->num_samples++;
   }
 
 void quicktime_compress_stts(quicktime_stts_t *stts)
@@ -27,6 +27,8 @@
 
 #include "lqt_private.h"
 
+#define LOG_DOMAIN "timecode"
+
 #define TIMECODES_PER_CHUNK 16
 
 void lqt_add_timecode_track(quicktime_t * file, int track,
@@ -43,6 +45,13 @@ void lqt_add_timecode_track(quicktime_t * file, int track,
   frame_duration = lqt_frame_duration(file, track, &constant);
 
   fps = (double)(time_scale) / (double)(frame_duration);
+
+  if(file->fragment)
+    {
+    lqt_log(file, LQT_LOG_ERROR, LOG_DOMAIN,
+            "Timecode tracks are not supported in fragmented files");
+    return;
+    }
   
   vm->timecode_track = quicktime_add_track(file);
   quicktime_trak_init_timecode(file, vm->timecode_track, time_scale, frame_duration,
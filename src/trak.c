@@ -302,6 +302,11 @@ int64_t quicktime_track_samples(quicktime_t *file, quicktime_trak_t *trak)
   quicktime_stts_t *stts = &trak->mdia.minf.stbl.stts;
   int i;
   int64_t total = 0;
+
+  if(stts->index_samples)
+    return trak->mdia.minf.is_audio ?
+      stts->index_times[stts->total_entries] :
+      stts->index_samples[stts->total_entries];
   
   if(trak->mdia.minf.is_audio)
     {
@@ -328,6 +333,15 @@ long quicktime_sample_of_chunk(quicktime_trak_t *trak, long chunk)
   long chunk1entry, chunk2entry;
   long chunk1, chunk2, chunks, total = 0;
 
+  if(trak->mdia.minf.stbl.stsc.sample_index)
+    {
+    chunk1entry = quicktime_stsc_find_chunk(&trak->mdia.minf.stbl.stsc, chunk - 1);
+    if(chunk1entry < 0)
+      return 0;
+    return trak->mdia.minf.stbl.stsc.sample_index[chunk1entry] +
+      (chunk - table[chunk1entry].chunk) * table[chunk1entry].samples;
+    }
+
   for(chunk1entry = total_entries - 1, chunk2entry = total_entries; 
       chunk1entry >= 0; 
       chunk1entry--, chunk2entry--)
@@ -393,23 +407,44 @@ int quicktime_chunk_of_sample(int64_t *chunk_sample,
     return 0;
     }
 
-  do
+  if(trak->mdia.minf.stbl.stsc.sample_index && (sample >= 0))
     {
-    chunk2 = table[chunk2entry].chunk-1;
-    *chunk = chunk2 - chunk1;
-    range_samples = *chunk * chunk1samples;
+    /* Binary search for the last entry starting at or before sample */
+    int64_t * index = trak->mdia.minf.stbl.stsc.sample_index;
+    long lo = 0, hi = total_entries - 1, mid;
 
-    if(sample < total + range_samples) break;
-
-    chunk1samples = table[chunk2entry].samples;
-    chunk1 = chunk2;
-
-    if(chunk2entry < total_entries)
+    while(lo < hi)
       {
-      chunk2entry++;
-      total += range_samples;
+      mid = lo + (hi - lo + 1) / 2;
+      if(index[mid] <= sample)
+        lo = mid;
+      else
+        hi = mid - 1;
       }
-    }while(chunk2entry < total_entries);
+    total = index[lo];
+    chunk1 = table[lo].chunk - 1;
+    chunk1samples = table[lo].samples;
+    }
+  else
+    {
+    do
+      {
+      chunk2 = table[chunk2entry].chunk-1;
+      *chunk = chunk2 - chunk1;
+      range_samples = *chunk * chunk1samples;
+
+      if(sample < total + range_samples) break;
+
+      chunk1samples = table[chunk2entry].samples;
+      chunk1 = chunk2;
+
+      if(chunk2entry < total_entries)
+        {
+        chunk2entry++;
+        total += range_samples;
+        }
+      }while(chunk2entry < total_entries);
+    }
 
   if(chunk1samples)
     *chunk = (sample - total) / chunk1samples + chunk1;
@@ -459,9 +494,20 @@ int64_t quicktime_sample_range_size(quicktime_trak_t *trak,
     /* probably video */
     else
       {
-      for(i = chunk_sample, total = 0; i < sample; i++)
+      quicktime_stsz_t * stsz = &trak->mdia.minf.stbl.stsz;
+      
+      if(stsz->size_index_enabled && !stsz->size_index && stsz->table)
+        quicktime_stsz_build_index(stsz);
+
+      if(stsz->size_index && (chunk_sample >= 0) &&
+         (chunk_sample <= sample) && (sample <= stsz->total_entries))
+        total = stsz->size_index[sample] - stsz->size_index[chunk_sample];
+      else
         {
-        total += trak->mdia.minf.stbl.stsz.table[i].size;
+        for(i = chunk_sample, total = 0; i < sample; i++)
+          {
+          total += stsz->table[i].size;
+          }
         }
       }
           
@@ -486,6 +532,10 @@ void quicktime_write_chunk_header(quicktime_t *file,
   {
   if(file->write_trak)
     quicktime_write_chunk_footer(file, file->write_trak);
+
+  /* Start a new movie fragment if necessary */
+  if(file->fragment)
+    quicktime_fragment_check(file, trak);
   
   if(file->file_type & (LQT_FILE_AVI|LQT_FILE_AVI_ODML))
     {
@@ -508,6 +558,10 @@ void quicktime_write_chunk_header(quicktime_t *file,
     /* Write AVI header */
     quicktime_atom_write_header(file, &trak->chunk_atom, tag);
     }
+  else if(file->interleave)
+    trak->chunk_atom.start = quicktime_interleave_start(file, trak);
+  else if(file->fragment)
+    trak->chunk_atom.start = quicktime_fragment_start_chunk(file);
   else
     trak->chunk_atom.start = quicktime_position(file);
 
@@ -542,12 +596,19 @@ void quicktime_write_chunk_footer(quicktime_t *file,
     if(sample_size > trak->strl->strh.dwSuggestedBufferSize)
       trak->strl->strh.dwSuggestedBufferSize = ((sample_size+15)/16)*16;
     }
-  if(offset + sample_size > file->mdat.atom.size)
+  if(!file->interleave && !file->fragment &&
+     (offset + sample_size > file->mdat.atom.size))
     file->mdat.atom.size = offset + sample_size;
 
-  quicktime_update_stco(&trak->mdia.minf.stbl.stco, 
-                        trak->chunk_num, 
-                        offset);
+  /* For fragmented files, chunks are stored until the next fragment
+     is written */
+  if(file->fragment)
+    quicktime_fragment_add_chunk(file, trak, offset, sample_size,
+                                 trak->chunk_samples);
+  else if(!file->interleave)
+    quicktime_update_stco(&trak->mdia.minf.stbl.stco, 
+                          trak->chunk_num, 
+                          offset);
 
   if(trak->mdia.minf.is_video || trak->mdia.minf.is_text)
     quicktime_update_stsz(&trak->mdia.minf.stbl.stsz, 
@@ -573,9 +634,13 @@ void quicktime_write_chunk_footer(quicktime_t *file,
                           sample_size);
     }
   
-  quicktime_update_stsc(&trak->mdia.minf.stbl.stsc, 
-                        trak->chunk_num, 
-                        trak->chunk_samples);
+  /* Interleaved chunks are added to stco and stsc when they are written */
+  if(file->interleave)
+    quicktime_interleave_add_chunk(file, trak->chunk_samples);
+  else if(!file->fragment)
+    quicktime_update_stsc(&trak->mdia.minf.stbl.stsc, 
+                          trak->chunk_num, 
+                          trak->chunk_samples);
 
   trak->chunk_num++;
   trak->chunk_samples = 0;
@@ -591,9 +656,12 @@ int quicktime_trak_duration(quicktime_trak_t *trak,
   int i;
   *duration = 0;
 
-  for(i = 0; i < stts->total_entries; i++)
+  if(stts->index_times)
+    *duration = stts->index_times[stts->total_entries];
+  else
     {
-    *duration += stts->table[i].sample_duration * stts->table[i].sample_count;
+    for(i = 0; i < stts->total_entries; i++)
+      *duration += stts->table[i].sample_duration * stts->table[i].sample_count;
     }
   if(timescale)
     *timescale = trak->mdia.mdhd.time_scale;
@@ -604,6 +672,14 @@ int quicktime_trak_duration(quicktime_trak_t *trak,
 static int fix_counts_read(quicktime_trak_t *trak,
                            int timescale, int moov_time_scale)
   {
+  quicktime_stsc_build_index(&trak->mdia.minf.stbl.stsc);
+  quicktime_stss_build_index(&trak->mdia.minf.stbl.stss,
+                             trak->mdia.minf.stbl.stsz.total_entries);
+  trak->mdia.minf.stbl.stsz.size_index_enabled = 1;
+  quicktime_stts_build_index(&trak->mdia.minf.stbl.stts);
+  if(trak->mdia.minf.stbl.has_ctts)
+    quicktime_ctts_build_index(&trak->mdia.minf.stbl.ctts);
+
   if(trak->has_edts)
     {
     trak->pts_offset = quicktime_elst_get_pts_offset(&trak->edts.elst,
@@ -684,16 +760,30 @@ long quicktime_chunk_samples(quicktime_trak_t *trak, long chunk)
   quicktime_stsc_t *stsc = &trak->mdia.minf.stbl.stsc;
   quicktime_stts_t *stts = &trak->mdia.minf.stbl.stts;
   quicktime_stsd_t *stsd = &trak->mdia.minf.stbl.stsd;
-  long i = stsc->total_entries - 1;
+  long i;
 
   if(!stsc->total_entries)
     return 0;
-  do
+
+  /* The binary search needs sorted chunk numbers, which is checked
+     when the index is built */
+  if(stsc->sample_index)
     {
-    current_chunk = stsc->table[i].chunk - 1;
+    i = quicktime_stsc_find_chunk(stsc, chunk + 1);
+    if(i < 0)
+      i = 0;
     result = stsc->table[i].samples;
-    i--;
-    }while(i >= 0 && current_chunk > chunk);
+    }
+  else
+    {
+    i = stsc->total_entries - 1;
+    do
+      {
+      current_chunk = stsc->table[i].chunk - 1;
+      result = stsc->table[i].samples;
+      i--;
+      }while(i >= 0 && current_chunk > chunk);
+    }
   /* LQT: Multiply with duration */
   if(stsd->table[0].compression_id == -2)
     result *= stts->table[0].sample_duration;
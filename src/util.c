@@ -33,6 +33,14 @@
 #include <time.h>
 #include <math.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+#include <fcntl.h>
+#endif
+
 #ifndef HAVE_LRINT
 #define lrint(x) ((long int)(x))
 #endif
@@ -47,6 +55,331 @@ int64_t quicktime_get_file_length(const char *path)
       return status.st_size;
 }
 
+/* Map a file, which is opened read only. If this fails (e.g. because the
+   file is a pipe or too large for the address space), we silently fall back
+   to stdio */
+
+static void file_map(quicktime_t *file)
+{
+#ifdef HAVE_MMAP
+	struct stat status;
+	void * ptr;
+	int fd = fileno(file->stream);
+
+	if(fstat(fd, &status) || !S_ISREG(status.st_mode) || (status.st_size <= 0))
+		return;
+
+	if((uint64_t)status.st_size > (uint64_t)((size_t)-1))
+		return;
+
+	ptr = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(ptr == MAP_FAILED)
+		return;
+
+	file->mmap_buffer = ptr;
+	file->mmap_size = status.st_size;
+#endif
+}
+
+static void file_unmap(quicktime_t *file)
+{
+#ifdef HAVE_MMAP
+	/* Memory files (without stream) use mmap_buffer for the
+	   user supplied data */
+	if(file->mmap_buffer && file->stream)
+		munmap(file->mmap_buffer, file->mmap_size);
+#endif
+	file->mmap_buffer = NULL;
+	file->mmap_size = 0;
+}
+
+/* Low level I/O: Custom callbacks or stdio */
+
+static int64_t file_read(quicktime_t *file, uint8_t *data, int64_t size)
+{
+	int64_t result;
+
+	if(file->io.read)
+	{
+		result = file->io.read(file->io_priv, data, size);
+		if(result < 0)
+		{
+			file->io_error = 1;
+			return 0;
+		}
+		if(result < size)
+			file->io_eof = 1;
+		return result;
+	}
+
+	result = fread(data, 1, size, file->stream);
+	if(result < size)
+	{
+		file->io_error = ferror(file->stream);
+		file->io_eof   = feof(file->stream);
+	}
+	return result;
+}
+
+static int64_t file_write(quicktime_t *file, const uint8_t *data, int64_t size)
+{
+	int64_t result;
+
+	if(file->io.write)
+	{
+		result = file->io.write(file->io_priv, data, size);
+		return (result < 0) ? 0 : result;
+	}
+	return fwrite(data, 1, size, file->stream);
+}
+
+static int64_t flush_presave(quicktime_t *file);
+
+/* Preallocation */
+
+/* Minimum step for extending the allocated space */
+#define PREALLOC_STEP (16*1024*1024)
+
+static void preallocate(quicktime_t *file, int64_t size)
+{
+	int fd;
+	int result = -1;
+
+	if(!file->stream || (size <= file->allocated_size))
+		return;
+
+	fd = fileno(file->stream);
+
+#ifdef HAVE_FALLOCATE
+	/* Don't change the file size, so nothing needs to be
+	   cut off if we crash */
+	result = fallocate(fd, FALLOC_FL_KEEP_SIZE, file->allocated_size,
+	                   size - file->allocated_size);
+#endif
+#ifdef HAVE_POSIX_FALLOCATE
+	if(result)
+		result = posix_fallocate(fd, file->allocated_size,
+		                         size - file->allocated_size);
+#endif
+	if(result)
+	{
+		/* Not supported, don't try again */
+		file->expected_size = 0;
+		return;
+	}
+	file->allocated_size = size;
+}
+
+void lqt_set_expected_size(quicktime_t * file, int64_t bytes)
+{
+	if(!file->wr)
+		return;
+	file->expected_size = bytes;
+	if(file->allocated_size < file->total_length)
+		file->allocated_size = file->total_length;
+	preallocate(file, bytes);
+}
+
+/* Called after writing: If the file became larger than our estimate,
+   allocate another big piece */
+
+static void preallocate_grow(quicktime_t *file)
+{
+	int64_t step;
+	
+	if(!file->expected_size || (file->total_length <= file->allocated_size))
+		return;
+
+	step = file->expected_size / 4;
+	if(step < PREALLOC_STEP)
+		step = PREALLOC_STEP;
+	preallocate(file, file->total_length + step);
+}
+
+/* Release the space we allocated beyond the end of the file */
+
+static void preallocate_trim(quicktime_t *file)
+{
+	if(!file->stream || (file->allocated_size <= file->total_length))
+		return;
+#ifdef HAVE_FTRUNCATE
+	fflush(file->stream);
+	if(ftruncate(fileno(file->stream), file->total_length))
+		lqt_log(file, LQT_LOG_WARNING, "util",
+		        "Could not release preallocated space");
+#endif
+}
+
+/* Built in memory I/O */
+
+typedef struct
+{
+	const uint8_t * rdata; /* Reading: User supplied data */
+	uint8_t * data;        /* Writing: Our own buffer */
+	int64_t size;
+	int64_t alloc;
+	int64_t pos;
+
+	/* Writing: Where to store the result */
+	uint8_t ** ret_data;
+	int64_t * ret_len;
+} memory_io_t;
+
+static int64_t memory_read(void * priv, uint8_t * data, int64_t len)
+{
+	memory_io_t * m = priv;
+
+	if(m->pos >= m->size)
+		return 0;
+	if(len > m->size - m->pos)
+		len = m->size - m->pos;
+	memcpy(data, m->rdata + m->pos, len);
+	m->pos += len;
+	return len;
+}
+
+static int64_t memory_write(void * priv, const uint8_t * data, int64_t len)
+{
+	memory_io_t * m = priv;
+	uint8_t * tmp;
+	int64_t new_alloc;
+
+	if(m->pos + len > m->alloc)
+	{
+		/* Grow geometrically */
+		new_alloc = m->alloc ? m->alloc : QUICKTIME_PRESAVE;
+		while(new_alloc < m->pos + len)
+			new_alloc *= 2;
+		if(!(tmp = realloc(m->data, new_alloc)))
+			return -1;
+		m->data = tmp;
+		m->alloc = new_alloc;
+	}
+	/* Fill holes left by seeking beyond the end */
+	if(m->pos > m->size)
+		memset(m->data + m->size, 0, m->pos - m->size);
+
+	memcpy(m->data + m->pos, data, len);
+	m->pos += len;
+	if(m->size < m->pos)
+		m->size = m->pos;
+	return len;
+}
+
+static int memory_seek(void * priv, int64_t pos)
+{
+	memory_io_t * m = priv;
+	if(pos < 0)
+		return 1;
+	m->pos = pos;
+	return 0;
+}
+
+static int64_t memory_size(void * priv)
+{
+	memory_io_t * m = priv;
+	return m->size;
+}
+
+static void memory_close(void * priv)
+{
+	memory_io_t * m = priv;
+
+	if(m->ret_data)
+		*m->ret_data = m->data;
+	else if(m->data)
+		free(m->data);
+
+	if(m->ret_len)
+		*m->ret_len = m->size;
+	free(m);
+}
+
+int quicktime_file_open_io(quicktime_t *file, const lqt_io_callbacks_t * io,
+                           void * priv, int rd, int wr)
+{
+	if(!io->seek ||
+	   (rd && (!io->read || !io->size)) ||
+	   (wr && !io->write))
+	{
+		/* The private data belong to us now */
+		if(io->close)
+			io->close(priv);
+		return 1;
+	}
+
+	file->io = *io;
+	file->io_priv = priv;
+
+	if(!wr)
+		file->io.write = NULL;
+	if(!rd)
+		file->io.read = NULL;
+
+	if(rd)
+	{
+		file->total_length = file->io.size(file->io_priv);
+		if(file->total_length < 0)
+		{
+			if(file->io.close)
+				file->io.close(file->io_priv);
+			memset(&file->io, 0, sizeof(file->io));
+			file->io_priv = NULL;
+			return 1;
+		}
+	}
+	if(wr)
+		file->presave_buffer = calloc(1, QUICKTIME_PRESAVE);
+	return 0;
+}
+
+int quicktime_file_open_memory(quicktime_t *file, const uint8_t * data, int64_t len)
+{
+	lqt_io_callbacks_t io;
+	memory_io_t * m;
+
+	memset(&io, 0, sizeof(io));
+	io.read  = memory_read;
+	io.seek  = memory_seek;
+	io.size  = memory_size;
+	io.close = memory_close;
+
+	if(!(m = calloc(1, sizeof(*m))))
+		return 1;
+	m->rdata = data;
+	m->size = len;
+
+	if(quicktime_file_open_io(file, &io, m, 1, 0))
+		return 1;
+
+	/* Zero copy reading through the mapping code */
+	file->mmap_buffer = (uint8_t*)data;
+	file->mmap_size = len;
+	return 0;
+}
+
+int quicktime_file_open_write_memory(quicktime_t *file, uint8_t ** data, int64_t * len)
+{
+	lqt_io_callbacks_t io;
+	memory_io_t * m;
+
+	memset(&io, 0, sizeof(io));
+	io.write = memory_write;
+	io.seek  = memory_seek;
+	io.size  = memory_size;
+	io.close = memory_close;
+
+	if(!(m = calloc(1, sizeof(*m))))
+		return 1;
+	m->ret_data = data;
+	m->ret_len = len;
+
+	*data = NULL;
+	*len = 0;
+
+	return quicktime_file_open_io(file, &io, m, 0, 1);
+}
+
 int quicktime_file_open(quicktime_t *file, const char *path, int rd, int wr)
 {
 	int exists = 0;
@@ -78,25 +411,36 @@ int quicktime_file_open(quicktime_t *file, const char *path, int rd, int wr)
 	{
 		file->total_length = quicktime_get_file_length(path);		
 	}
+	if(rd && !wr)
+		file_map(file);
         if(wr)
+          {
           file->presave_buffer = calloc(1, QUICKTIME_PRESAVE);	
+          file->path = strdup(path);
+          }
 	return 0;
 }
 
 int quicktime_file_close(quicktime_t *file)
 {
 /* Flush presave buffer */
-        if(file->presave_size)
-        {
-                quicktime_fseek(file, file->presave_position - file->presave_size);
-                fwrite(file->presave_buffer, 1, file->presave_size, file->stream);
-                file->presave_size = 0;
-        }
+        flush_presave(file);
+        quicktime_writer_stop(file);
+        preallocate_trim(file);
  
+        quicktime_readahead_stop(file);
+        file_unmap(file);
+
         if(file->stream)
         {
                 fclose(file->stream);
         }
+        else if(file->io.close)
+        {
+                file->io.close(file->io_priv);
+        }
+        memset(&file->io, 0, sizeof(file->io));
+        file->io_priv = NULL;
         file->stream = 0;
         return 0;
 }
@@ -110,6 +454,8 @@ int quicktime_fseek(quicktime_t *file, int64_t offset)
 {
 	file->ftell_position = offset;
 	if(offset > file->total_length || offset < 0) return 1;
+	if(file->io.seek)
+		return !!file->io.seek(file->io_priv, file->ftell_position);
 	if(fseeko(file->stream, file->ftell_position, SEEK_SET))
 	{
 //		perror("quicktime_fseek fseeko");
@@ -156,16 +502,34 @@ int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size)
   /* Return if we had an error before */
   if(file->io_error || file->io_eof)
     return 0;
-  
-  if(!file->preload_size)
+
+  /* Reading back data, which might still be queued */
+  if(file->writer)
+    quicktime_writer_sync(file);
+
+  if(file->mmap_buffer && !file->preload_size)
     {
-    quicktime_fseek(file, file->file_position);
-    result = fread(data, 1, size, file->stream);
+    /* Serve the request directly from the mapping. The preload buffer
+       has precedence because it's also used for parsing in-memory atoms
+       (compressed moov, stsd) */
+    if(file->file_position < 0)
+      result = 0;
+    else if(file->file_position + size > file->mmap_size)
+      result = file->mmap_size - file->file_position;
+    else
+      result = size;
+
+    if(result < 0)
+      result = 0;
+    if(result)
+      memcpy(data, file->mmap_buffer + file->file_position, result);
     if(result < size)
-      {
-      file->io_error = ferror(file->stream);
-      file->io_eof   = feof(file->stream);
-      }
+      file->io_eof = 1;
+    }
+  else if(!file->preload_size)
+    {
+    quicktime_fseek(file, file->file_position);
+    result = file_read(file, data, size);
     file->ftell_position += size;
     }
   else
@@ -179,12 +543,7 @@ int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size)
       {
       /* Size is larger than preload size.  Should never happen. */
       quicktime_fseek(file, file->file_position);
-      result = fread(data, 1, size, file->stream);
-      if(result < size)
-        {
-        file->io_error = ferror(file->stream);
-        file->io_eof   = feof(file->stream);
-        }
+      result = file_read(file, data, size);
       file->ftell_position += size;
       }
     else if(selection_start >= file->preload_start && 
@@ -222,14 +581,8 @@ int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size)
         if(fragment_start + fragment_len > file->preload_size)
           fragment_len = file->preload_size - fragment_start;
         quicktime_fseek(file, file->preload_end);
-        result = fread(&file->preload_buffer[fragment_start],
-                       fragment_len, 1, file->stream);
-
-        if(result < fragment_len)
-          {
-          file->io_error = ferror(file->stream);
-          file->io_eof   = feof(file->stream);
-          }
+        file_read(file, &file->preload_buffer[fragment_start],
+                  fragment_len);
         file->ftell_position += fragment_len;
         file->preload_end += fragment_len;
         fragment_start += fragment_len;
@@ -245,12 +598,7 @@ int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size)
       /* Range is before buffer or over a preload_size away from the end of the buffer. */
       /* Replace entire preload buffer with range. */
       quicktime_fseek(file, file->file_position);
-      result = fread(file->preload_buffer, 1, size, file->stream);
-      if(result < size)
-        {
-        file->io_error = ferror(file->stream);
-        file->io_eof   = feof(file->stream);
-        }
+      result = file_read(file, file->preload_buffer, size);
       file->ftell_position += size;
       file->preload_start = file->file_position;
       file->preload_end = file->file_position + size;
@@ -264,6 +612,65 @@ int quicktime_read_data(quicktime_t *file, uint8_t *data, int64_t size)
   return result;
   }
 
+/* Return a pointer into the file mapping for the next size bytes and
+   advance the position. NULL is returned if the file is not mapped or
+   the range is not completely inside the mapping. */
+
+const uint8_t * quicktime_peek_data(quicktime_t *file, int64_t size)
+  {
+  const uint8_t * ret;
+  
+  if(!file->mmap_buffer || file->preload_size ||
+     file->io_error || file->io_eof ||
+     (file->file_position < 0) ||
+     (file->file_position + size > file->mmap_size))
+    return NULL;
+
+  ret = file->mmap_buffer + file->file_position;
+  file->file_position += size;
+  return ret;
+  }
+
+/* Write out the presave buffer. Returns the number of bytes written.
+   With the asynchronous writer, the buffer is queued instead. */
+
+static int64_t flush_presave(quicktime_t *file)
+  {
+  int64_t result;
+  
+  if(!file->presave_size)
+    return 0;
+
+  if(file->writer)
+    {
+    result = file->presave_size;
+    if(quicktime_writer_submit(file))
+      return result;
+    return 0;
+    }
+  
+  quicktime_fseek(file, file->presave_position - file->presave_size);
+  result = file_write(file, file->presave_buffer, file->presave_size);
+  file->presave_size = 0;
+  return result;
+  }
+
+/* Write a block at an absolute position without touching the
+   position variables of the file. Used by the writer thread. */
+
+int64_t quicktime_write_block(quicktime_t *file, int64_t offset,
+                              const uint8_t *data, int64_t size)
+  {
+  if(file->io.seek)
+    {
+    if(file->io.seek(file->io_priv, offset))
+      return 0;
+    }
+  else if(fseeko(file->stream, offset, SEEK_SET))
+    return 0;
+  return file_write(file, data, size);
+  }
+
 int quicktime_write_data(quicktime_t *file, const uint8_t *data, int size)
   {
   int data_offset = 0;
@@ -272,17 +679,48 @@ int quicktime_write_data(quicktime_t *file, const uint8_t *data, int size)
 
   if(file->io_error)
     return 0;
+
+  if(file->interleave && quicktime_interleave_write(file, data, size))
+    return 1;
+
+  if(file->fragment && quicktime_fragment_write(file, data, size))
+    return 1;
+
+  /* Large payloads (e.g. uncompressed video frames) are written
+     directly from the callers buffer after flushing the presave buffer.
+     The asynchronous writer needs the data in its own buffers. */
+  if((size >= QUICKTIME_DIRECT_WRITE) && !file->writer)
+    {
+    int64_t result;
+    
+    writes_attempted += file->presave_size;
+    writes_succeeded += flush_presave(file);
+
+    quicktime_fseek(file, file->file_position);
+    result = file_write(file, data, size);
+
+    file->file_position += size;
+    file->presave_position = file->file_position;
+    file->ftell_position = file->file_position;
+    if(file->total_length < file->ftell_position)
+      file->total_length = file->ftell_position;
+    preallocate_grow(file);
+
+    if((result < size) || (writes_succeeded < writes_attempted))
+      {
+      file->io_error = file->stream ? ferror(file->stream) : 1;
+      if(!file->io_error)
+        file->io_error = 1;
+      return 0;
+      }
+    return 1;
+    }
   
   // Flush existing buffer and seek to new position
   if(file->file_position != file->presave_position)
     {
-    if(file->presave_size)
-      {
-      quicktime_fseek(file, file->presave_position - file->presave_size);
-      writes_succeeded += fwrite(file->presave_buffer, 1, file->presave_size, file->stream);
-      writes_attempted += file->presave_size;
-      file->presave_size = 0;
-      }
+    writes_attempted += file->presave_size;
+    writes_succeeded += flush_presave(file);
     file->presave_position = file->file_position;
     }
 
@@ -305,10 +743,8 @@ int quicktime_write_data(quicktime_t *file, const uint8_t *data, int size)
 
     if(file->presave_size >= QUICKTIME_PRESAVE)
       {
-      quicktime_fseek(file, file->presave_position - file->presave_size);
-      writes_succeeded += fwrite(file->presave_buffer, 1, file->presave_size, file->stream);
       writes_attempted += file->presave_size;
-      file->presave_size = 0;
+      writes_succeeded += flush_presave(file);
       }
     }
 
@@ -318,11 +754,13 @@ int quicktime_write_data(quicktime_t *file, const uint8_t *data, int size)
   file->ftell_position = file->presave_position;
   /* Adjust total length */
   if(file->total_length < file->ftell_position) file->total_length = file->ftell_position;
+  preallocate_grow(file);
 
   /* fwrite failed */
   if(!writes_succeeded && writes_attempted)
     {
-    file->io_error = ferror(file->stream);
+    if(!file->io_error)
+      file->io_error = file->stream ? ferror(file->stream) : 1;
     return 0;
     }
   else
@@ -834,6 +1272,13 @@ quicktime_read_data(file, (uint8_t*)string, 4);
 
 int64_t quicktime_position(quicktime_t *file) 
 { 
+	int64_t ret;
+	/* Inside a buffered chunk (see lqt_interleave.c) */
+	if(file->interleave && ((ret = quicktime_interleave_position(file)) >= 0))
+		return ret;
+	/* Inside the media data of a movie fragment (see lqt_fragment.c) */
+	if(file->fragment && ((ret = quicktime_fragment_position(file)) >= 0))
+		return ret;
 	return file->file_position; 
 }
 
@@ -28,13 +28,14 @@
 
 int main(int argc, char *argv[])
 {
-	if(argc < 3 || argv[1][0] == '-')
+	if(argc < 2 || argv[1][0] == '-')
 	{
-		printf("usage: %s <in filename> <out filename>\n", argv[0]);
+		printf("usage: %s <in filename> [<out filename>]\n", argv[0]);
+		printf("Without output file, the file is converted in place\n");
 		exit(1);
 	}
 
-	if(quicktime_make_streamable(argv[1], argv[2]))
+	if(quicktime_make_streamable(argv[1], (argc > 2) ? argv[2] : NULL))
 		exit(1);
 
 	return 0;